@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "os_anf.h"
+
+#define ANF_GRAIN		1024
+#define ANF_EFFECTIVE_QUANTILE	0.9
+
+typedef struct {
+	os_graph_t *graph;
+	unsigned int log2m;
+	size_t m;
+	double alpha;
+	// 2^-r for every register value r
+	double inv_pow2[66];
+
+	// Registers of the previous and of the current step, m bytes per node
+	uint8_t *cur, *next;
+	// Nodes whose registers changed at the previous and at the current step
+	uint8_t *changed, *next_changed;
+
+	// Per task sums of the estimates and counts of changed nodes
+	double *partial_sums;
+	unsigned int *partial_changed;
+} anf_ctx_t;
+
+static inline uint64_t mix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* Register-wise maximum of two counters, into dst. */
+static inline bool merge_counter(uint8_t *dst, const uint8_t *src, size_t m)
+{
+#ifdef __SSE2__
+	int unchanged = 0xffff;
+
+	for (size_t j = 0; j < m; j += 16) {
+		__m128i a = _mm_load_si128((const __m128i *) (dst + j));
+		__m128i max = _mm_max_epu8(a, _mm_load_si128((const __m128i *) (src + j)));
+
+		unchanged &= _mm_movemask_epi8(_mm_cmpeq_epi8(a, max));
+		_mm_store_si128((__m128i *) (dst + j), max);
+	}
+
+	return unchanged != 0xffff;
+#else
+	bool changed = false;
+
+	for (size_t j = 0; j < m; j++) {
+		if (src[j] > dst[j]) {
+			dst[j] = src[j];
+			changed = true;
+		}
+	}
+
+	return changed;
+#endif
+}
+
+/* HyperLogLog estimate of the size of a set, with the small range correction. */
+static double estimate(anf_ctx_t *ctx, const uint8_t *regs)
+{
+	unsigned int zeros = 0;
+	double sum = 0, e;
+
+	for (size_t j = 0; j < ctx->m; j++) {
+		sum += ctx->inv_pow2[regs[j]];
+		zeros += regs[j] == 0;
+	}
+
+	e = ctx->alpha * ctx->m * ctx->m / sum;
+	if (e <= 2.5 * ctx->m && zeros > 0)
+		e = ctx->m * log((double) ctx->m / zeros);
+
+	return e;
+}
+
+/* Put every node of [begin, end) in its own counter. */
+static void init_counters(void *arg, unsigned int begin, unsigned int end)
+{
+	anf_ctx_t *ctx = arg;
+	double sum = 0;
+
+	for (unsigned int v = begin; v < end; v++) {
+		uint8_t *regs = ctx->cur + (size_t) v * ctx->m;
+		uint64_t h = mix64(v), w = h << ctx->log2m;
+
+		memset(regs, 0, ctx->m);
+		regs[h >> (64 - ctx->log2m)] = w != 0 ? (unsigned int) __builtin_clzll(w) + 1 :
+			64 - ctx->log2m + 1;
+		ctx->changed[v] = 1;
+		sum += estimate(ctx, regs);
+	}
+
+	ctx->partial_sums[begin / ANF_GRAIN] = sum;
+}
+
+/*
+ * One step for nodes [begin, end): the counter of a node becomes the union
+ * of its counter and of those of its neighbours. Only counters next to a
+ * change of the previous step can change.
+ */
+static void update_counters(void *arg, unsigned int begin, unsigned int end)
+{
+	anf_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+	unsigned int num_changed = 0;
+	double sum = 0;
+
+	for (unsigned int v = begin; v < end; v++) {
+		uint8_t *regs = ctx->next + (size_t) v * ctx->m;
+		unsigned int *neighbours = graph_neighbours(graph, v);
+		bool changed = false;
+
+		memcpy(regs, ctx->cur + (size_t) v * ctx->m, ctx->m);
+		for (unsigned int i = 0; i < graph_degree(graph, v); i++) {
+			unsigned int u = neighbours[i];
+
+			if (ctx->changed[u])
+				changed |= merge_counter(regs, ctx->cur + (size_t) u * ctx->m,
+							 ctx->m);
+		}
+
+		ctx->next_changed[v] = changed;
+		num_changed += changed;
+		sum += estimate(ctx, regs);
+	}
+
+	ctx->partial_sums[begin / ANF_GRAIN] = sum;
+	ctx->partial_changed[begin / ANF_GRAIN] = num_changed;
+}
+
+static void summarize(os_anf_result_t *result)
+{
+	double *nf = result->neighbourhood;
+	unsigned int steps = result->num_steps;
+	double target = ANF_EFFECTIVE_QUANTILE * nf[steps], pairs, weighted = 0;
+	unsigned int t;
+
+	for (t = 0; t < steps && nf[t] < target; t++)
+		;
+	if (t == 0 || nf[t] == nf[t - 1])
+		result->effective_diameter = t;
+	else
+		result->effective_diameter = t - 1 + (target - nf[t - 1]) / (nf[t] - nf[t - 1]);
+
+	for (t = 1; t <= steps; t++)
+		weighted += t * (nf[t] - nf[t - 1]);
+	pairs = nf[steps] - nf[0];
+	result->average_distance = pairs > 0 ? weighted / pairs : 0;
+}
+
+/*
+ * Estimate the distance distribution of a graph with HyperANF: every node
+ * has a HyperLogLog counter of the nodes within distance t, and step t + 1
+ * merges the counters of the neighbours into it, with a SIMD register-wise
+ * maximum. Steps run in parallel on tp (serially if tp is NULL), each
+ * from the counters of the previous one, until no counter changes or
+ * after max_steps steps (0 for no limit). The counters take
+ * 2 << log2m bytes per node.
+ * Returns result->error.
+ */
+int hyperanf(os_threadpool_t *tp, os_graph_t *graph, unsigned int log2m,
+		unsigned int max_steps, os_anf_result_t *result)
+{
+	unsigned int n = graph->num_nodes, num_tasks = n / ANF_GRAIN + 1;
+	size_t cap = 16;
+	anf_ctx_t ctx;
+	int rc = 0;
+
+	memset(result, 0, sizeof(*result));
+	if (log2m < OS_ANF_MIN_LOG2M || log2m > OS_ANF_MAX_LOG2M) {
+		result->error = -EINVAL;
+		return result->error;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.graph = graph;
+	ctx.log2m = log2m;
+	ctx.m = (size_t) 1 << log2m;
+	ctx.alpha = ctx.m == 16 ? 0.673 : ctx.m == 32 ? 0.697 : ctx.m == 64 ? 0.709 :
+		0.7213 / (1 + 1.079 / ctx.m);
+	for (unsigned int r = 0; r < sizeof(ctx.inv_pow2) / sizeof(ctx.inv_pow2[0]); r++)
+		ctx.inv_pow2[r] = ldexp(1.0, -(int) r);
+
+	if (posix_memalign((void **) &ctx.cur, 64, (size_t) n * ctx.m + 1) != 0)
+		ctx.cur = NULL;
+	if (posix_memalign((void **) &ctx.next, 64, (size_t) n * ctx.m + 1) != 0)
+		ctx.next = NULL;
+	ctx.changed = malloc(n + 1);
+	ctx.next_changed = malloc(n + 1);
+	ctx.partial_sums = calloc(num_tasks, sizeof(*ctx.partial_sums));
+	ctx.partial_changed = calloc(num_tasks, sizeof(*ctx.partial_changed));
+	result->neighbourhood = malloc(cap * sizeof(*result->neighbourhood));
+	if (ctx.cur == NULL || ctx.next == NULL || ctx.changed == NULL ||
+	    ctx.next_changed == NULL || ctx.partial_sums == NULL ||
+	    ctx.partial_changed == NULL || result->neighbourhood == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	parallel_for(tp, n, ANF_GRAIN, init_counters, &ctx);
+	result->neighbourhood[0] = 0;
+	for (unsigned int i = 0; i < num_tasks; i++)
+		result->neighbourhood[0] += ctx.partial_sums[i];
+
+	while (max_steps == 0 || result->num_steps < max_steps) {
+		unsigned int num_changed = 0;
+		uint8_t *tmp;
+		double sum = 0;
+
+		memset(ctx.partial_changed, 0, num_tasks * sizeof(*ctx.partial_changed));
+		parallel_for(tp, n, ANF_GRAIN, update_counters, &ctx);
+		for (unsigned int i = 0; i < num_tasks; i++) {
+			sum += ctx.partial_sums[i];
+			num_changed += ctx.partial_changed[i];
+		}
+		if (num_changed == 0)
+			break;
+
+		if (result->num_steps + 2 > cap) {
+			double *nf = realloc(result->neighbourhood, 2 * cap * sizeof(*nf));
+
+			if (nf == NULL) {
+				rc = -ENOMEM;
+				goto out;
+			}
+			result->neighbourhood = nf;
+			cap *= 2;
+		}
+		result->neighbourhood[++result->num_steps] = sum;
+
+		tmp = ctx.cur, ctx.cur = ctx.next, ctx.next = tmp;
+		tmp = ctx.changed, ctx.changed = ctx.next_changed, ctx.next_changed = tmp;
+	}
+
+	summarize(result);
+
+out:
+	if (rc < 0) {
+		free(result->neighbourhood);
+		result->neighbourhood = NULL;
+	}
+	free(ctx.cur);
+	free(ctx.next);
+	free(ctx.changed);
+	free(ctx.next_changed);
+	free(ctx.partial_sums);
+	free(ctx.partial_changed);
+	result->error = rc;
+
+	return rc;
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_ANF_H__
+#define __OS_ANF_H__	1
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+// Each node has 1 << log2m HyperLogLog registers of one byte
+#define OS_ANF_MIN_LOG2M	4
+#define OS_ANF_MAX_LOG2M	12
+#define OS_ANF_DEFAULT_LOG2M	5
+
+/* Distance distribution estimated by hyperanf(). */
+typedef struct os_anf_result_t {
+	// 0 on success, a negative errno value otherwise
+	int error;
+
+	/*
+	 * Neighbourhood function: estimated number of ordered pairs of nodes
+	 * at distance at most t, for t from 0 to num_steps, to free().
+	 */
+	double *neighbourhood;
+	unsigned int num_steps;
+
+	// Interpolated distance within which 90% of the connected pairs are
+	double effective_diameter;
+	// Average distance between connected pairs of distinct nodes
+	double average_distance;
+} os_anf_result_t;
+
+int hyperanf(os_threadpool_t *tp, os_graph_t *graph, unsigned int log2m,
+		unsigned int max_steps, os_anf_result_t *result);
+
+#endif
@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+
+#include "os_betweenness.h"
+
+#define MERGE_GRAIN		(16 * 1024)
+
+/*
+ * Scratch state of one worker: the search arrays, indexed by node and
+ * cleared after each source through the list of the nodes it reached, and
+ * the dependencies accumulated over all the sources it ran.
+ */
+typedef struct {
+	int *dist;
+	double *sigma, *delta;
+	unsigned int *order;
+	double *scores;
+} bc_workspace_t;
+
+typedef struct {
+	os_threadpool_t *tp;
+	os_graph_t *graph;
+	unsigned int *sources;
+
+	bc_workspace_t *ws;
+	unsigned int num_ws;
+
+	double *scores;
+	double scale;
+	int error;
+} bc_ctx_t;
+
+static inline uint64_t mix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static void workspace_destroy(bc_workspace_t *w)
+{
+	free(w->dist);
+	free(w->sigma);
+	free(w->delta);
+	free(w->order);
+	free(w->scores);
+	memset(w, 0, sizeof(*w));
+}
+
+static int workspace_init(bc_workspace_t *w, unsigned int n)
+{
+	size_t size = (size_t) n + 1;
+
+	w->dist = malloc(size * sizeof(*w->dist));
+	w->sigma = malloc(size * sizeof(*w->sigma));
+	w->delta = malloc(size * sizeof(*w->delta));
+	w->order = malloc(size * sizeof(*w->order));
+	w->scores = calloc(size, sizeof(*w->scores));
+	if (w->dist == NULL || w->sigma == NULL || w->delta == NULL ||
+	    w->order == NULL || w->scores == NULL) {
+		workspace_destroy(w);
+		return -ENOMEM;
+	}
+
+	memset(w->dist, 0xff, size * sizeof(*w->dist));
+
+	return 0;
+}
+
+/*
+ * Brandes' algorithm from one source: a BFS counting the shortest paths to
+ * every node, then the dependencies of the source on each node, accumulated
+ * in the reverse order of the BFS.
+ */
+static void accumulate(bc_workspace_t *w, os_graph_t *graph, unsigned int source)
+{
+	unsigned int head = 0, tail = 0;
+
+	w->dist[source] = 0;
+	w->sigma[source] = 1;
+	w->order[tail++] = source;
+
+	while (head < tail) {
+		unsigned int u = w->order[head++], degree = graph_degree(graph, u);
+		unsigned int *nb = graph_neighbours(graph, u);
+
+		w->delta[u] = 0;
+		for (unsigned int i = 0; i < degree; i++) {
+			unsigned int v = nb[i];
+
+			if (w->dist[v] < 0) {
+				w->dist[v] = w->dist[u] + 1;
+				w->sigma[v] = 0;
+				w->order[tail++] = v;
+			}
+			if (w->dist[v] == w->dist[u] + 1)
+				w->sigma[v] += w->sigma[u];
+		}
+	}
+
+	while (tail > 0) {
+		unsigned int v = w->order[--tail], degree = graph_degree(graph, v);
+		unsigned int *nb = graph_neighbours(graph, v);
+
+		for (unsigned int i = 0; i < degree; i++) {
+			unsigned int u = nb[i];
+
+			if (w->dist[u] == w->dist[v] - 1)
+				w->delta[u] += w->sigma[u] / w->sigma[v] * (1 + w->delta[v]);
+		}
+		if (v != source)
+			w->scores[v] += w->delta[v];
+		w->dist[v] = -1;
+	}
+}
+
+static void run_sources(void *arg, unsigned int begin, unsigned int end)
+{
+	bc_ctx_t *ctx = arg;
+	int idx = threadpool_worker_index(ctx->tp);
+	bc_workspace_t *w = &ctx->ws[idx < 0 ? ctx->num_ws - 1 : (unsigned int) idx];
+
+	if (w->dist == NULL && workspace_init(w, ctx->graph->num_nodes) < 0) {
+		__atomic_store_n(&ctx->error, -ENOMEM, __ATOMIC_RELAXED);
+		return;
+	}
+
+	for (unsigned int i = begin; i < end; i++)
+		accumulate(w, ctx->graph, ctx->sources != NULL ? ctx->sources[i] : i);
+}
+
+/* Sum the scores of the workers over a range of nodes. */
+static void merge_scores(void *arg, unsigned int begin, unsigned int end)
+{
+	bc_ctx_t *ctx = arg;
+
+	for (unsigned int v = begin; v < end; v++) {
+		double sum = 0;
+
+		for (unsigned int i = 0; i < ctx->num_ws; i++) {
+			if (ctx->ws[i].scores != NULL)
+				sum += ctx->ws[i].scores[v];
+		}
+		ctx->scores[v] = sum * ctx->scale;
+	}
+}
+
+/*
+ * Pick k distinct sources uniformly, by a partial Fisher-Yates shuffle
+ * drawing from the SplitMix64 sequence of seed.
+ */
+static unsigned int *sample_sources(unsigned int n, unsigned int k, uint64_t seed)
+{
+	unsigned int *nodes = malloc(((size_t) n + 1) * sizeof(*nodes));
+
+	if (nodes == NULL)
+		return NULL;
+
+	for (unsigned int i = 0; i < n; i++)
+		nodes[i] = i;
+	for (unsigned int i = 0; i < k; i++) {
+		unsigned int j = i + mix64(seed + i * 0x9e3779b97f4a7c15ULL) % (n - i), tmp = nodes[i];
+
+		nodes[i] = nodes[j];
+		nodes[j] = tmp;
+	}
+
+	return nodes;
+}
+
+/*
+ * Number of sampled sources for which the normalized betweenness of every
+ * node, its score over (n - 1)(n - 2) / 2, is within epsilon of the exact
+ * one with probability 1 - OS_BETWEENNESS_DELTA, by Hoeffding's bound and
+ * a union bound over the nodes.
+ */
+unsigned int betweenness_sample_size(unsigned int num_nodes, double epsilon)
+{
+	double k;
+
+	if (epsilon <= 0)
+		return num_nodes;
+
+	k = ceil(log(2.0 * num_nodes / OS_BETWEENNESS_DELTA) / (2 * epsilon * epsilon));
+
+	return k < num_nodes ? (unsigned int) k : num_nodes;
+}
+
+/*
+ * Betweenness centrality by Brandes' algorithm, the sources spread across
+ * the workers of tp (serially if tp is NULL). Each worker accumulates into
+ * its own score array and the arrays are summed at the end. With
+ * num_samples 0, or at least the number of nodes, every node is a source
+ * and the scores are exact; otherwise num_samples sources are drawn at
+ * random from seed and the scores are scaled to estimate the exact ones.
+ * The error bound of the estimate only holds if the seed itself is
+ * random; a fixed seed reproduces a run.
+ */
+int betweenness(os_threadpool_t *tp, os_graph_t *graph, unsigned int num_samples,
+		uint64_t seed, os_betweenness_result_t *result)
+{
+	unsigned int n = graph->num_nodes;
+	bc_ctx_t ctx;
+	int rc = 0;
+
+	memset(result, 0, sizeof(*result));
+	result->exact = num_samples == 0 || num_samples >= n;
+	result->num_sources = result->exact ? n : num_samples;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.tp = tp;
+	ctx.graph = graph;
+	ctx.num_ws = (tp != NULL ? tp->num_threads : 0) + 1;
+	ctx.ws = calloc(ctx.num_ws, sizeof(*ctx.ws));
+	result->scores = calloc((size_t) n + 1, sizeof(*result->scores));
+	if (!result->exact)
+		ctx.sources = sample_sources(n, num_samples, seed);
+	if (ctx.ws == NULL || result->scores == NULL ||
+	    (!result->exact && ctx.sources == NULL)) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	parallel_for(tp, result->num_sources, 1, run_sources, &ctx);
+	rc = ctx.error;
+	if (rc < 0)
+		goto out;
+
+	// Both directions of every pair were counted if all nodes were sources
+	ctx.scores = result->scores;
+	ctx.scale = result->exact ? 0.5 : 0.5 * n / num_samples;
+	parallel_for(tp, n, MERGE_GRAIN, merge_scores, &ctx);
+
+out:
+	if (rc < 0) {
+		free(result->scores);
+		result->scores = NULL;
+		result->error = rc;
+	}
+	for (unsigned int i = 0; ctx.ws != NULL && i < ctx.num_ws; i++)
+		workspace_destroy(&ctx.ws[i]);
+	free(ctx.ws);
+	free(ctx.sources);
+
+	return rc;
+}
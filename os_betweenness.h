@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_BETWEENNESS_H__
+#define __OS_BETWEENNESS_H__	1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+// Failure probability of the error bound of betweenness_sample_size()
+#define OS_BETWEENNESS_DELTA	0.1
+
+/* Betweenness centrality computed by betweenness(). */
+typedef struct os_betweenness_result_t {
+	// 0 on success, a negative errno value otherwise
+	int error;
+
+	/*
+	 * Number of shortest paths between pairs of other nodes going through
+	 * each node, each unordered pair counted once, to free(). Estimates
+	 * scaled to the whole graph if the sources were sampled.
+	 */
+	double *scores;
+
+	// Sources the searches were run from, all the nodes if exact
+	unsigned int num_sources;
+	bool exact;
+} os_betweenness_result_t;
+
+int betweenness(os_threadpool_t *tp, os_graph_t *graph, unsigned int num_samples,
+		uint64_t seed, os_betweenness_result_t *result);
+unsigned int betweenness_sample_size(unsigned int num_nodes, double epsilon);
+
+#endif
@@ -0,0 +1,452 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "os_biconnected.h"
+#include "log/log.h"
+
+#define BCC_GRAIN		1024
+#define BCC_UNSET		UINT_MAX
+
+/*
+ * State of the Tarjan-Vishkin algorithm. The nodes are numbered in
+ * preorder of a breadth first spanning forest; the edge from a node to its
+ * parent in the forest is named after the node. low and high are the
+ * smallest and largest preorder numbers reached by a non-tree edge from
+ * the subtree of a node, or of the node itself.
+ */
+typedef struct {
+	os_threadpool_t *tp;
+	os_graph_t *graph;
+	os_bcc_t *bcc;
+
+	unsigned int *parent, *pre, *size;
+	unsigned int *low, *high;
+
+	/*
+	 * Nodes in the order of the search, each level of each tree in a
+	 * segment starting at level_start[i]; a level only has children in
+	 * the following segments.
+	 */
+	unsigned int *order, *level_start;
+	unsigned int num_levels, tail;
+	// Segment of the current parallel step
+	unsigned int begin;
+
+	// Union-find over the tree edges, giving the components
+	unsigned int *uf;
+} bcc_ctx_t;
+
+static inline unsigned int load(unsigned int *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static unsigned int uf_find(unsigned int *uf, unsigned int x)
+{
+	for (;;) {
+		unsigned int parent = load(&uf[x]), grandparent;
+
+		if (parent == x)
+			return x;
+
+		grandparent = load(&uf[parent]);
+		if (grandparent != parent)
+			__atomic_compare_exchange_n(&uf[x], &parent, grandparent, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		x = parent;
+	}
+}
+
+/* Link the larger root under the smaller one, so links can't form a cycle. */
+static void uf_union(unsigned int *uf, unsigned int a, unsigned int b)
+{
+	for (;;) {
+		unsigned int tmp;
+
+		a = uf_find(uf, a);
+		b = uf_find(uf, b);
+		if (a == b)
+			return;
+		if (a < b)
+			tmp = a, a = b, b = tmp;
+
+		tmp = a;
+		if (__atomic_compare_exchange_n(&uf[a], &tmp, b, false,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
+static void atomic_min(unsigned int *p, unsigned int v)
+{
+	unsigned int cur = load(p);
+
+	while (v < cur && !__atomic_compare_exchange_n(p, &cur, v, false,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void atomic_max(unsigned int *p, unsigned int v)
+{
+	unsigned int cur = load(p);
+
+	while (v > cur && !__atomic_compare_exchange_n(p, &cur, v, false,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/* Whether a is an ancestor of b, or b itself. */
+static inline bool is_ancestor(bcc_ctx_t *ctx, unsigned int a, unsigned int b)
+{
+	return ctx->pre[a] <= ctx->pre[b] && ctx->pre[b] < ctx->pre[a] + ctx->size[a];
+}
+
+/* Claim the unclaimed neighbours of a level as children, forming the next level. */
+static void expand_tree(void *arg, unsigned int begin, unsigned int end)
+{
+	bcc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+
+	for (unsigned int i = ctx->begin + begin; i < ctx->begin + end; i++) {
+		unsigned int v = ctx->order[i], *nb = graph_neighbours(graph, v);
+
+		for (unsigned int j = 0; j < graph_degree(graph, v); j++) {
+			unsigned int w = nb[j], expected = BCC_UNSET;
+
+			if (load(&ctx->parent[w]) != BCC_UNSET ||
+			    !__atomic_compare_exchange_n(&ctx->parent[w], &expected, v,
+					false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				continue;
+			ctx->order[__atomic_fetch_add(&ctx->tail, 1, __ATOMIC_RELAXED)] = w;
+		}
+	}
+}
+
+/* Breadth first spanning forest, one tree per connected component. */
+static void build_forest(bcc_ctx_t *ctx)
+{
+	unsigned int n = ctx->graph->num_nodes, head;
+
+	for (unsigned int root = 0; root < n; root++) {
+		if (ctx->parent[root] != BCC_UNSET)
+			continue;
+
+		ctx->parent[root] = root;
+		head = ctx->tail;
+		ctx->order[ctx->tail++] = root;
+		while (head < ctx->tail) {
+			unsigned int end = ctx->tail;
+
+			ctx->level_start[ctx->num_levels++] = head;
+			ctx->begin = head;
+			parallel_for(ctx->tp, end - head, BCC_GRAIN, expand_tree, ctx);
+			head = end;
+		}
+	}
+	ctx->level_start[ctx->num_levels] = n;
+}
+
+/* Run fn over each level, from the leaves up if bottom_up is set. */
+static void for_each_level(bcc_ctx_t *ctx, bool bottom_up,
+		void (*fn)(void *arg, unsigned int begin, unsigned int end))
+{
+	for (unsigned int i = 0; i < ctx->num_levels; i++) {
+		unsigned int l = bottom_up ? ctx->num_levels - 1 - i : i;
+
+		ctx->begin = ctx->level_start[l];
+		parallel_for(ctx->tp, ctx->level_start[l + 1] - ctx->begin, BCC_GRAIN,
+			     fn, ctx);
+	}
+}
+
+static void add_sizes(void *arg, unsigned int begin, unsigned int end)
+{
+	bcc_ctx_t *ctx = arg;
+
+	for (unsigned int i = ctx->begin + begin; i < ctx->begin + end; i++) {
+		unsigned int v = ctx->order[i];
+
+		if (ctx->parent[v] != v)
+			__atomic_add_fetch(&ctx->size[ctx->parent[v]], load(&ctx->size[v]),
+					__ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Number the children of each node of a level in preorder: each one
+ * follows the subtrees of the previous ones.
+ */
+static void number_children(void *arg, unsigned int begin, unsigned int end)
+{
+	bcc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+
+	for (unsigned int i = ctx->begin + begin; i < ctx->begin + end; i++) {
+		unsigned int v = ctx->order[i], *nb = graph_neighbours(graph, v);
+		unsigned int next = ctx->pre[v] + 1;
+
+		for (unsigned int j = 0; j < graph_degree(graph, v); j++) {
+			unsigned int w = nb[j];
+
+			if (w == v || ctx->parent[w] != v || ctx->pre[w] != BCC_UNSET)
+				continue;
+			ctx->pre[w] = next;
+			next += ctx->size[w];
+		}
+	}
+}
+
+/*
+ * Fold the non-tree edges of each node of a level into its low and high,
+ * which already hold those of its children, and pass them to its parent.
+ * One copy of the edge to the parent is the tree edge, others are not.
+ */
+static void fold_low_high(void *arg, unsigned int begin, unsigned int end)
+{
+	bcc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+
+	for (unsigned int i = ctx->begin + begin; i < ctx->begin + end; i++) {
+		unsigned int v = ctx->order[i], *nb = graph_neighbours(graph, v);
+		unsigned int p = ctx->parent[v], low, high;
+		bool tree_edge = p != v;
+
+		low = load(&ctx->low[v]);
+		high = load(&ctx->high[v]);
+		if (ctx->pre[v] < low)
+			low = ctx->pre[v];
+		if (ctx->pre[v] > high)
+			high = ctx->pre[v];
+
+		for (unsigned int j = 0; j < graph_degree(graph, v); j++) {
+			unsigned int w = nb[j];
+
+			if (w == p && tree_edge) {
+				tree_edge = false;
+				continue;
+			}
+			if (ctx->pre[w] < low)
+				low = ctx->pre[w];
+			if (ctx->pre[w] > high)
+				high = ctx->pre[w];
+		}
+
+		ctx->low[v] = low;
+		ctx->high[v] = high;
+		if (p != v) {
+			atomic_min(&ctx->low[p], low);
+			atomic_max(&ctx->high[p], high);
+		}
+	}
+}
+
+/*
+ * Join the tree edges of the same component. The tree edge of v is in the
+ * component of that of its parent p if an edge leaves the subtree of v for
+ * a node outside the subtree of p. A non-tree edge joins the tree edges of
+ * its ends unless one is an ancestor of the other. A tree edge is a bridge
+ * if no edge leaves the subtree of its lower end.
+ */
+static void link_edges(void *arg, unsigned int begin, unsigned int end)
+{
+	bcc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+	os_bcc_t *bcc = ctx->bcc;
+
+	for (unsigned int v = begin; v < end; v++) {
+		unsigned int p = ctx->parent[v], *nb = graph_neighbours(graph, v);
+
+		if (p == v)
+			continue;
+
+		if (ctx->low[v] >= ctx->pre[v] && ctx->high[v] < ctx->pre[v] + ctx->size[v]) {
+			unsigned int k = __atomic_fetch_add(&bcc->num_bridges, 1,
+					__ATOMIC_RELAXED);
+
+			bcc->bridges[k].src = p;
+			bcc->bridges[k].dst = v;
+		}
+
+		if (ctx->parent[p] != p && (ctx->low[v] < ctx->pre[p] ||
+		    ctx->high[v] >= ctx->pre[p] + ctx->size[p]))
+			uf_union(ctx->uf, v, p);
+
+		for (unsigned int j = 0; j < graph_degree(graph, v); j++) {
+			unsigned int w = nb[j];
+
+			if (ctx->pre[w] < ctx->pre[v] && !is_ancestor(ctx, w, v))
+				uf_union(ctx->uf, v, w);
+		}
+	}
+}
+
+/*
+ * An edge is in the component of the tree edge of its end later in
+ * preorder. Nodes with edges in several components are articulation
+ * points. Record the component of each entry of the adjacency if asked.
+ */
+static void classify_edges(void *arg, unsigned int begin, unsigned int end)
+{
+	bcc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+	os_bcc_t *bcc = ctx->bcc;
+	unsigned int *label = bcc->edge_component;
+
+	for (unsigned int v = begin; v < end; v++) {
+		unsigned int *nb = graph_neighbours(graph, v), first = OS_BCC_NONE;
+
+		for (unsigned int j = 0; j < graph_degree(graph, v); j++) {
+			unsigned int w = nb[j], c;
+
+			c = w == v ? OS_BCC_NONE : ctx->uf[ctx->pre[w] > ctx->pre[v] ? w : v];
+			if (label != NULL)
+				label[graph->offsets[v] + j] = c;
+			if (c == OS_BCC_NONE)
+				continue;
+			if (first == OS_BCC_NONE)
+				first = c;
+			else if (c != first)
+				bcc->articulation[v] = true;
+		}
+	}
+}
+
+/* Number the components, replacing each union-find entry with its number. */
+static void number_components(bcc_ctx_t *ctx)
+{
+	unsigned int n = ctx->graph->num_nodes, k = 0;
+	unsigned int *id = ctx->size;
+
+	for (unsigned int v = 0; v < n; v++) {
+		if (ctx->parent[v] != v && ctx->uf[v] == v)
+			id[v] = k++;
+	}
+	for (unsigned int v = 0; v < n; v++) {
+		if (ctx->parent[v] != v)
+			ctx->low[v] = id[uf_find(ctx->uf, v)];
+	}
+	for (unsigned int v = 0; v < n; v++) {
+		if (ctx->parent[v] != v)
+			ctx->uf[v] = ctx->low[v];
+	}
+
+	ctx->bcc->num_components = k;
+}
+
+static void init_nodes(void *arg, unsigned int begin, unsigned int end)
+{
+	bcc_ctx_t *ctx = arg;
+
+	for (unsigned int v = begin; v < end; v++) {
+		ctx->parent[v] = BCC_UNSET;
+		ctx->pre[v] = BCC_UNSET;
+		ctx->size[v] = 1;
+		ctx->low[v] = BCC_UNSET;
+		ctx->high[v] = 0;
+		ctx->uf[v] = v;
+	}
+}
+
+/*
+ * Biconnected components, articulation points and bridges by the
+ * Tarjan-Vishkin algorithm, in parallel on tp (serially if tp is NULL).
+ * A breadth first spanning forest replaces the depth first search of
+ * Tarjan's algorithm: every step is a parallel loop over the nodes or over
+ * one level of the forest, without recursion, whatever the depth of the
+ * graph. If label_edges is set, the component of every edge is recorded.
+ */
+os_bcc_t *biconnected_components(os_threadpool_t *tp, os_graph_t *graph,
+		bool label_edges)
+{
+	unsigned int n = graph->num_nodes, total = 0;
+	size_t size = (size_t) n + 1;
+	os_bcc_t *bcc;
+	bcc_ctx_t ctx;
+	int rc = 0;
+
+	bcc = calloc(1, sizeof(*bcc));
+	if (bcc == NULL) {
+		log_error("Not enough memory");
+		return NULL;
+	}
+	bcc->num_nodes = n;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.tp = tp;
+	ctx.graph = graph;
+	ctx.bcc = bcc;
+	ctx.parent = malloc(size * sizeof(*ctx.parent));
+	ctx.pre = malloc(size * sizeof(*ctx.pre));
+	ctx.size = malloc(size * sizeof(*ctx.size));
+	ctx.low = malloc(size * sizeof(*ctx.low));
+	ctx.high = malloc(size * sizeof(*ctx.high));
+	ctx.order = malloc(size * sizeof(*ctx.order));
+	ctx.level_start = malloc(size * sizeof(*ctx.level_start));
+	ctx.uf = malloc(size * sizeof(*ctx.uf));
+	bcc->articulation = calloc(size, sizeof(*bcc->articulation));
+	bcc->bridges = malloc(size * sizeof(*bcc->bridges));
+	if (label_edges)
+		bcc->edge_component = malloc((graph->offsets[n] + 1) *
+					     sizeof(*bcc->edge_component));
+	if (ctx.parent == NULL || ctx.pre == NULL || ctx.size == NULL ||
+	    ctx.low == NULL || ctx.high == NULL || ctx.order == NULL ||
+	    ctx.level_start == NULL || ctx.uf == NULL ||
+	    bcc->articulation == NULL || bcc->bridges == NULL ||
+	    (label_edges && bcc->edge_component == NULL)) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	parallel_for(tp, n, BCC_GRAIN, init_nodes, &ctx);
+	build_forest(&ctx);
+	for_each_level(&ctx, true, add_sizes);
+
+	// The trees follow each other in preorder
+	for (unsigned int i = 0; i < ctx.num_levels; i++) {
+		unsigned int v = ctx.order[ctx.level_start[i]];
+
+		if (ctx.parent[v] == v) {
+			ctx.pre[v] = total;
+			total += ctx.size[v];
+		}
+	}
+	for_each_level(&ctx, false, number_children);
+	for_each_level(&ctx, true, fold_low_high);
+
+	parallel_for(tp, n, BCC_GRAIN, link_edges, &ctx);
+	number_components(&ctx);
+	parallel_for(tp, n, BCC_GRAIN, classify_edges, &ctx);
+
+	for (unsigned int v = 0; v < n; v++)
+		bcc->num_articulation_points += bcc->articulation[v];
+
+out:
+	if (rc < 0) {
+		log_error("Can't compute the biconnected components: %s", strerror(-rc));
+		destroy_bcc(bcc);
+		bcc = NULL;
+	}
+
+	free(ctx.parent);
+	free(ctx.pre);
+	free(ctx.size);
+	free(ctx.low);
+	free(ctx.high);
+	free(ctx.order);
+	free(ctx.level_start);
+	free(ctx.uf);
+
+	return bcc;
+}
+
+void destroy_bcc(os_bcc_t *bcc)
+{
+	free(bcc->articulation);
+	free(bcc->bridges);
+	free(bcc->edge_component);
+	free(bcc);
+}
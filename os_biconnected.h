@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_BICONNECTED_H__
+#define __OS_BICONNECTED_H__	1
+
+#include <stdbool.h>
+#include <limits.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+// Component of the self loops, which are in none
+#define OS_BCC_NONE	UINT_MAX
+
+/*
+ * Biconnected components of a graph, seen as undirected: the classes of
+ * edges lying on a common simple cycle, or alone if they are bridges.
+ * Their numbers depend on the spanning tree found by the search.
+ */
+typedef struct os_bcc_t {
+	unsigned int num_nodes;
+	unsigned int num_components;
+
+	// Whether each node is an articulation point, and their number
+	bool *articulation;
+	unsigned int num_articulation_points;
+
+	// Bridges, from their end nearest to the root of the spanning tree
+	os_edge_t *bridges;
+	unsigned int num_bridges;
+
+	// If asked for, the component of each entry of graph->neighbours
+	unsigned int *edge_component;
+} os_bcc_t;
+
+os_bcc_t *biconnected_components(os_threadpool_t *tp, os_graph_t *graph,
+		bool label_edges);
+void destroy_bcc(os_bcc_t *bcc);
+
+#endif
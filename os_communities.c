@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "os_communities.h"
+#include "log/log.h"
+
+#define LPA_GRAIN		1024
+#define LPA_EMPTY		UINT_MAX
+
+/*
+ * Label frequencies among the neighbours of a node: an open addressing
+ * table, with the list of its used slots to clear it in time linear in the
+ * degree. Each worker has its own, grown to fit the largest degree seen.
+ */
+typedef struct {
+	unsigned int cap;
+	unsigned int *labels, *counts, *used;
+} lpa_table_t;
+
+typedef struct {
+	os_threadpool_t *tp;
+	os_graph_t *graph;
+	unsigned int *label;
+	unsigned int round;
+
+	// Nodes are visited in the order p -> (a * p + b) mod n
+	unsigned long long a, b;
+
+	lpa_table_t *tables;
+	unsigned int num_tables;
+
+	unsigned int *partial_changed;
+	int error;
+} lpa_ctx_t;
+
+static inline uint64_t mix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static unsigned long long gcd(unsigned long long a, unsigned long long b)
+{
+	while (b != 0) {
+		unsigned long long t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+static int table_reserve(lpa_table_t *t, unsigned int degree)
+{
+	unsigned int cap = 16;
+
+	while (cap < 2 * (size_t) degree)
+		cap *= 2;
+	if (cap <= t->cap)
+		return 0;
+
+	free(t->labels);
+	free(t->counts);
+	free(t->used);
+	t->labels = malloc(cap * sizeof(*t->labels));
+	t->counts = malloc(cap * sizeof(*t->counts));
+	t->used = malloc(cap / 2 * sizeof(*t->used));
+	if (t->labels == NULL || t->counts == NULL || t->used == NULL) {
+		t->cap = 0;
+		return -ENOMEM;
+	}
+	t->cap = cap;
+	memset(t->labels, 0xff, cap * sizeof(*t->labels));
+
+	return 0;
+}
+
+/*
+ * Most frequent label among the neighbours of node. Ties keep the current
+ * label of the node if it is among them, otherwise go to the label with the
+ * smallest hash in this round, so that no label is favoured for good.
+ */
+static unsigned int best_label(lpa_ctx_t *ctx, lpa_table_t *t, unsigned int node,
+		unsigned int current)
+{
+	os_graph_t *graph = ctx->graph;
+	unsigned int degree = graph_degree(graph, node), num_used = 0;
+	unsigned int *nb = graph_neighbours(graph, node), mask = t->cap - 1;
+	unsigned int best = current, best_count = 0, current_count = 0;
+	uint64_t best_hash = UINT64_MAX;
+
+	for (unsigned int i = 0; i < degree; i++) {
+		unsigned int l = __atomic_load_n(&ctx->label[nb[i]], __ATOMIC_RELAXED);
+		unsigned int s = (unsigned int) mix64(l) & mask;
+
+		while (t->labels[s] != l && t->labels[s] != LPA_EMPTY)
+			s = (s + 1) & mask;
+		if (t->labels[s] == LPA_EMPTY) {
+			t->labels[s] = l;
+			t->counts[s] = 0;
+			t->used[num_used++] = s;
+		}
+		t->counts[s]++;
+	}
+
+	for (unsigned int i = 0; i < num_used; i++) {
+		unsigned int s = t->used[i], l = t->labels[s], count = t->counts[s];
+		uint64_t h;
+
+		t->labels[s] = LPA_EMPTY;
+		if (l == current)
+			current_count = count;
+		if (count < best_count)
+			continue;
+
+		h = mix64(((uint64_t) ctx->round << 32) | l);
+		if (count > best_count || h < best_hash) {
+			best = l;
+			best_count = count;
+			best_hash = h;
+		}
+	}
+
+	return current_count == best_count ? current : best;
+}
+
+static void propagate(void *arg, unsigned int begin, unsigned int end)
+{
+	lpa_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+	unsigned int n = graph->num_nodes, changed = 0;
+	int idx = threadpool_worker_index(ctx->tp);
+	lpa_table_t *t = &ctx->tables[idx < 0 ? ctx->num_tables - 1 : (unsigned int) idx];
+
+	for (unsigned int p = begin; p < end; p++) {
+		unsigned int node = (ctx->a * p + ctx->b) % n;
+		unsigned int current, l;
+
+		if (graph_degree(graph, node) == 0)
+			continue;
+		if (table_reserve(t, graph_degree(graph, node)) < 0) {
+			__atomic_store_n(&ctx->error, -ENOMEM, __ATOMIC_RELAXED);
+			return;
+		}
+
+		current = __atomic_load_n(&ctx->label[node], __ATOMIC_RELAXED);
+		l = best_label(ctx, t, node, current);
+		if (l != current) {
+			__atomic_store_n(&ctx->label[node], l, __ATOMIC_RELAXED);
+			changed++;
+		}
+	}
+
+	ctx->partial_changed[begin / LPA_GRAIN] = changed;
+}
+
+/* Number the communities by their smallest node and aggregate their info. */
+static int number_communities(lpa_ctx_t *ctx, os_communities_t *c)
+{
+	os_graph_t *graph = ctx->graph;
+	unsigned int n = graph->num_nodes, k = 0;
+	unsigned int *id = ctx->partial_changed;
+
+	// Labels are node numbers, reuse the round buffer as the label map
+	id = realloc(id, ((size_t) n + 1) * sizeof(*id));
+	if (id == NULL)
+		return -ENOMEM;
+	ctx->partial_changed = id;
+	memset(id, 0xff, n * sizeof(*id));
+
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned int l = ctx->label[i];
+
+		if (id[l] == LPA_EMPTY)
+			id[l] = k++;
+		c->community[i] = id[l];
+	}
+
+	c->num_communities = k;
+	c->sizes = calloc(k + 1, sizeof(*c->sizes));
+	c->sums = calloc(k + 1, sizeof(*c->sums));
+	c->min_info = malloc((k + 1) * sizeof(*c->min_info));
+	c->max_info = malloc((k + 1) * sizeof(*c->max_info));
+	if (c->sizes == NULL || c->sums == NULL || c->min_info == NULL ||
+	    c->max_info == NULL)
+		return -ENOMEM;
+
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned int j = c->community[i];
+		int v = graph->info[i];
+
+		if (c->sizes[j] == 0 || v < c->min_info[j])
+			c->min_info[j] = v;
+		if (c->sizes[j] == 0 || v > c->max_info[j])
+			c->max_info[j] = v;
+		c->sizes[j]++;
+		c->sums[j] += v;
+	}
+
+	return 0;
+}
+
+/*
+ * Find communities by asynchronous label propagation, in parallel on tp
+ * (serially if tp is NULL). Every node starts with its own label and, round
+ * after round, takes the most frequent label among its neighbours, reading
+ * the labels already updated in the same round. Each round visits the nodes
+ * in a different pseudo-random order. Propagation stops when at most a
+ * threshold fraction of the nodes changed label in a round, or after
+ * max_rounds rounds if it is not 0.
+ */
+os_communities_t *label_propagation(os_threadpool_t *tp, os_graph_t *graph,
+		double threshold, unsigned int max_rounds)
+{
+	unsigned int n = graph->num_nodes, num_tasks = n / LPA_GRAIN + 1;
+	os_communities_t *c;
+	lpa_ctx_t ctx;
+	int rc = 0;
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) {
+		log_error("Not enough memory");
+		return NULL;
+	}
+	c->num_nodes = n;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.tp = tp;
+	ctx.graph = graph;
+	ctx.num_tables = (tp != NULL ? tp->num_threads : 0) + 1;
+	ctx.tables = calloc(ctx.num_tables, sizeof(*ctx.tables));
+	ctx.partial_changed = calloc(num_tasks, sizeof(*ctx.partial_changed));
+	ctx.label = malloc(((size_t) n + 1) * sizeof(*ctx.label));
+	c->community = malloc(((size_t) n + 1) * sizeof(*c->community));
+	if (ctx.tables == NULL || ctx.partial_changed == NULL || ctx.label == NULL ||
+	    c->community == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < n; i++)
+		ctx.label[i] = i;
+
+	while (n > 0 && (max_rounds == 0 || c->num_rounds < max_rounds)) {
+		unsigned int num_changed = 0;
+
+		ctx.round = c->num_rounds++;
+		ctx.a = mix64(2 * ctx.round) % n;
+		while (n > 1 && (ctx.a == 0 || gcd(ctx.a, n) != 1))
+			ctx.a = (ctx.a + 1) % n;
+		ctx.b = mix64(2 * ctx.round + 1) % n;
+
+		parallel_for(tp, n, LPA_GRAIN, propagate, &ctx);
+		rc = ctx.error;
+		if (rc < 0)
+			goto out;
+
+		for (unsigned int i = 0; i < num_tasks; i++)
+			num_changed += ctx.partial_changed[i];
+		if (num_changed <= threshold * n)
+			break;
+	}
+
+	rc = number_communities(&ctx, c);
+
+out:
+	if (rc < 0) {
+		log_error("Can't compute the communities: %s", strerror(-rc));
+		destroy_communities(c);
+		c = NULL;
+	}
+
+	for (unsigned int i = 0; ctx.tables != NULL && i < ctx.num_tables; i++) {
+		free(ctx.tables[i].labels);
+		free(ctx.tables[i].counts);
+		free(ctx.tables[i].used);
+	}
+	free(ctx.tables);
+	free(ctx.partial_changed);
+	free(ctx.label);
+
+	return c;
+}
+
+void destroy_communities(os_communities_t *c)
+{
+	free(c->community);
+	free(c->sizes);
+	free(c->sums);
+	free(c->min_info);
+	free(c->max_info);
+	free(c);
+}
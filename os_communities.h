@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_COMMUNITIES_H__
+#define __OS_COMMUNITIES_H__	1
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+// Stop once fewer than this fraction of the nodes change label in a round
+#define OS_LPA_DEFAULT_THRESHOLD	0.001
+#define OS_LPA_DEFAULT_MAX_ROUNDS	100
+
+/*
+ * Communities found by label propagation, numbered in the order of their
+ * smallest node, with aggregates of the info of their nodes.
+ */
+typedef struct os_communities_t {
+	unsigned int num_nodes;
+	unsigned int num_communities;
+	// Rounds of propagation run
+	unsigned int num_rounds;
+
+	// Community of each node
+	unsigned int *community;
+
+	// Per community: size, sum, smallest and largest info
+	unsigned int *sizes;
+	long long *sums;
+	int *min_info, *max_info;
+} os_communities_t;
+
+os_communities_t *label_propagation(os_threadpool_t *tp, os_graph_t *graph,
+		double threshold, unsigned int max_rounds);
+void destroy_communities(os_communities_t *c);
+
+#endif
@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "os_components.h"
+#include "os_graph_parse.h"
+#include "log/log.h"
+
+// The edge section is split in chunks of about this size, one task each
+#define STREAM_CHUNK_SIZE	(1UL << 20)
+#define LABEL_GRAIN		(64 * 1024)
+
+/*
+ * Union-find node: the parent in the low 32 bits and the rank above them,
+ * so both are read and replaced together by a single CAS.
+ */
+#define UF_PARENT(w)		((unsigned int) (w))
+#define UF_RANK(w)		((unsigned int) ((w) >> 32))
+#define UF_PACK(rank, parent)	((uint64_t) (rank) << 32 | (parent))
+// Marks the root entries reused for the component numbers
+#define UF_LABEL		(1ULL << 63)
+
+typedef struct {
+	os_threadpool_t *tp;
+	const char *edges, *end;
+	unsigned int num_nodes;
+	uint64_t *uf;
+	unsigned int *component;
+	unsigned long long num_edges;
+	int error;
+} stream_ctx_t;
+
+/* Find the root of x, halving the path on the way. */
+static unsigned int uf_find(uint64_t *uf, unsigned int x)
+{
+	for (;;) {
+		uint64_t w = __atomic_load_n(&uf[x], __ATOMIC_RELAXED);
+		unsigned int parent = UF_PARENT(w), grandparent;
+
+		if (parent == x)
+			return x;
+
+		grandparent = UF_PARENT(__atomic_load_n(&uf[parent], __ATOMIC_RELAXED));
+		if (grandparent != parent)
+			__atomic_compare_exchange_n(&uf[x], &w,
+					UF_PACK(UF_RANK(w), grandparent), false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		x = parent;
+	}
+}
+
+/*
+ * Link the roots of a and b. The root with the lower (rank, index) goes
+ * under the other one: that order only grows along parent links, so
+ * concurrent unions can't create a cycle. A link only succeeds if its CAS
+ * sees the node still a root with the rank it was compared with.
+ */
+static void uf_union(uint64_t *uf, unsigned int a, unsigned int b)
+{
+	for (;;) {
+		uint64_t wa, wb;
+		unsigned int ra, rb, tmp;
+
+		a = uf_find(uf, a);
+		b = uf_find(uf, b);
+		if (a == b)
+			return;
+
+		wa = __atomic_load_n(&uf[a], __ATOMIC_RELAXED);
+		wb = __atomic_load_n(&uf[b], __ATOMIC_RELAXED);
+		if (UF_PARENT(wa) != a || UF_PARENT(wb) != b)
+			continue;
+
+		ra = UF_RANK(wa);
+		rb = UF_RANK(wb);
+		if (ra > rb || (ra == rb && a > b)) {
+			tmp = a, a = b, b = tmp;
+			tmp = ra, ra = rb, rb = tmp;
+			wa = wb;
+		}
+
+		if (!__atomic_compare_exchange_n(&uf[a], &wa, UF_PACK(ra, b), false,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			continue;
+
+		if (ra == rb) {
+			wb = UF_PACK(rb, b);
+			__atomic_compare_exchange_n(&uf[b], &wb, UF_PACK(rb + 1, b), false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		}
+		return;
+	}
+}
+
+/* Start of the first line starting at or after the nominal start of chunk c. */
+static const char *chunk_start(stream_ctx_t *ctx, unsigned int c)
+{
+	const char *p = ctx->edges + (size_t) c * STREAM_CHUNK_SIZE;
+
+	if (p >= ctx->end)
+		return ctx->end;
+	if (p > ctx->edges && p[-1] != '\n') {
+		p = memchr(p, '\n', ctx->end - p);
+		p = p != NULL ? p + 1 : ctx->end;
+	}
+
+	return p;
+}
+
+/* Union the edges of chunks [begin, end), then drop their text from memory. */
+static void union_chunks(void *arg, unsigned int begin, unsigned int end)
+{
+	stream_ctx_t *ctx = arg;
+	long page = sysconf(_SC_PAGESIZE);
+
+	for (unsigned int c = begin; c < end; c++) {
+		const char *p = chunk_start(ctx, c), *stop = chunk_start(ctx, c + 1);
+		const char *first = p;
+		unsigned long long count = 0;
+		uintptr_t lo, hi;
+		unsigned int src, dst;
+
+		while (p < stop) {
+			p = parse_uint(p, stop, &src);
+			if (p == NULL) {
+				// Only whitespace may follow the last edge
+				break;
+			}
+			p = parse_uint(p, stop, &dst);
+			if (p == NULL || src >= ctx->num_nodes || dst >= ctx->num_nodes) {
+				__atomic_store_n(&ctx->error, -EINVAL, __ATOMIC_RELAXED);
+				return;
+			}
+			uf_union(ctx->uf, src, dst);
+			count++;
+		}
+		__atomic_add_fetch(&ctx->num_edges, count, __ATOMIC_RELAXED);
+
+		// Pages shared with the next chunks are just read again
+		lo = ((uintptr_t) first + page - 1) & ~((uintptr_t) page - 1);
+		hi = (uintptr_t) stop & ~((uintptr_t) page - 1);
+		if (hi > lo)
+			madvise((void *) lo, hi - lo, MADV_DONTNEED);
+	}
+}
+
+static void find_roots(void *arg, unsigned int begin, unsigned int end)
+{
+	stream_ctx_t *ctx = arg;
+
+	for (unsigned int i = begin; i < end; i++)
+		ctx->component[i] = uf_find(ctx->uf, i);
+}
+
+/* Number the components by their smallest node and sum their info. */
+static int label_components(stream_ctx_t *ctx, const int *info, os_components_t *cc)
+{
+	unsigned int n = ctx->num_nodes, k = 0;
+
+	parallel_for(ctx->tp, n, LABEL_GRAIN, find_roots, ctx);
+
+	// Roots don't change anymore, their entries hold the component numbers
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned int root = ctx->component[i];
+
+		if (!(ctx->uf[root] & UF_LABEL))
+			ctx->uf[root] = UF_LABEL | k++;
+		ctx->component[i] = (unsigned int) ctx->uf[root];
+	}
+
+	cc->num_components = k;
+	cc->sums = calloc(k + 1, sizeof(*cc->sums));
+	cc->sizes = calloc(k + 1, sizeof(*cc->sizes));
+	if (cc->sums == NULL || cc->sizes == NULL)
+		return -ENOMEM;
+
+	for (unsigned int i = 0; i < n; i++) {
+		cc->sums[ctx->component[i]] += info[i];
+		cc->sizes[ctx->component[i]]++;
+	}
+
+	return 0;
+}
+
+/*
+ * Compute the connected components of a graph file in the native format
+ * without building the graph. The node values are parsed first, then the
+ * edge section is streamed once, in chunks handled in parallel on tp,
+ * through a lock-free union-find. Memory use is linear in the number of
+ * nodes: parsed text is dropped from memory as the chunks are done.
+ * The file must be a regular file, to be mapped and split.
+ */
+os_components_t *stream_components(os_threadpool_t *tp, const char *path)
+{
+	unsigned int num_nodes, num_edges, num_chunks;
+	os_components_t *cc = NULL;
+	stream_ctx_t ctx;
+	struct stat st;
+	const char *p, *data = MAP_FAILED;
+	int *info = NULL;
+	int fd, rc = -EINVAL;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.tp = tp;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		log_error("Can't map %s, a regular graph file is needed", path);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		log_error("Can't map %s", path);
+		return NULL;
+	}
+	ctx.end = data + st.st_size;
+
+	p = parse_uint(data, ctx.end, &num_nodes);
+	if (p != NULL)
+		p = parse_uint(p, ctx.end, &num_edges);
+	if (p == NULL)
+		goto out;
+
+	info = malloc(((size_t) num_nodes + 1) * sizeof(*info));
+	ctx.uf = malloc(((size_t) num_nodes + 1) * sizeof(*ctx.uf));
+	cc = calloc(1, sizeof(*cc));
+	if (cc != NULL)
+		cc->component = malloc(((size_t) num_nodes + 1) * sizeof(*cc->component));
+	if (info == NULL || ctx.uf == NULL || cc == NULL || cc->component == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	cc->num_nodes = num_nodes;
+	ctx.num_nodes = num_nodes;
+	ctx.component = cc->component;
+
+	for (unsigned int i = 0; i < num_nodes && p != NULL; i++)
+		p = parse_int(p, ctx.end, &info[i]);
+	if (p == NULL)
+		goto out;
+
+	for (unsigned int i = 0; i < num_nodes; i++)
+		ctx.uf[i] = UF_PACK(0, i);
+
+	ctx.edges = p;
+	num_chunks = (ctx.end - p) / STREAM_CHUNK_SIZE + 1;
+	parallel_for(tp, num_chunks, 1, union_chunks, &ctx);
+	rc = ctx.error;
+	if (rc == 0 && ctx.num_edges != num_edges)
+		rc = -EINVAL;
+	if (rc == 0)
+		rc = label_components(&ctx, info, cc);
+
+out:
+	if (rc < 0) {
+		if (rc == -EINVAL)
+			log_error("Invalid graph file %s", path);
+		else
+			log_error("Can't compute the components: %s", strerror(-rc));
+		if (cc != NULL)
+			destroy_components(cc);
+		cc = NULL;
+	}
+
+	munmap((void *) data, st.st_size);
+	free(ctx.uf);
+	free(info);
+
+	return cc;
+}
+
+void destroy_components(os_components_t *cc)
+{
+	free(cc->component);
+	free(cc->sums);
+	free(cc->sizes);
+	free(cc);
+}
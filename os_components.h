@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_COMPONENTS_H__
+#define __OS_COMPONENTS_H__	1
+
+#include "os_threadpool.h"
+
+/*
+ * Connected components of a graph. Components are numbered in the order
+ * of their smallest node, so node 0 is always in component 0.
+ */
+typedef struct os_components_t {
+	unsigned int num_nodes;
+	unsigned int num_components;
+
+	// Component of each node
+	unsigned int *component;
+
+	// Sum of the info of the nodes and number of nodes of each component
+	long long *sums;
+	unsigned int *sizes;
+} os_components_t;
+
+os_components_t *stream_components(os_threadpool_t *tp, const char *path);
+void destroy_components(os_components_t *cc);
+
+#endif
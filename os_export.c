@@ -0,0 +1,582 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <float.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "os_export.h"
+#include "os_graph_compress.h"
+#include "os_graph_image.h"
+#include "os_traverse.h"
+
+#define EXPORT_CHUNK_NODES	4096
+#define EXPORT_WINDOW_CHUNKS	64
+#define EXPORT_MAX_IOV		64
+
+// Longest "%.17g" form of a double, as in -2.2250738585072014e-308
+#define EXPORT_DOUBLE_LEN	24
+
+typedef struct {
+	char *data;
+	size_t len, cap;
+} export_buf_t;
+
+typedef struct {
+	os_graph_t *graph;
+	const long long *values;
+	const double *doubles;
+	// BFS tree, exported instead of the graph if either array is set
+	const unsigned int *parent, *level;
+	bool tree;
+	os_export_format_t format;
+	unsigned int num_nodes;
+
+	// First node of the current window
+	unsigned int first_node;
+	export_buf_t bufs[EXPORT_WINDOW_CHUNKS];
+
+	// One buffer per block of the compressed format
+	export_buf_t *blocks;
+	int error;
+} export_ctx_t;
+
+static const char digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* Write the decimal form of a number, two digits at a time. */
+static char *format_ulong(char *p, unsigned long long v)
+{
+	char tmp[20];
+	char *t = tmp + sizeof(tmp);
+	size_t len;
+
+	while (v >= 100) {
+		unsigned int pair = (v % 100) * 2;
+
+		v /= 100;
+		*--t = digit_pairs[pair + 1];
+		*--t = digit_pairs[pair];
+	}
+	if (v >= 10) {
+		*--t = digit_pairs[v * 2 + 1];
+		*--t = digit_pairs[v * 2];
+	} else {
+		*--t = '0' + v;
+	}
+
+	len = tmp + sizeof(tmp) - t;
+	memcpy(p, t, len);
+
+	return p + len;
+}
+
+static char *format_long(char *p, long long v)
+{
+	if (v < 0) {
+		*p++ = '-';
+		return format_ulong(p, -(unsigned long long) v);
+	}
+
+	return format_ulong(p, v);
+}
+
+/* Upper bound of the size of the text of nodes [begin, end). */
+static size_t chunk_bound(export_ctx_t *ctx, unsigned int begin, unsigned int end)
+{
+	os_graph_t *graph = ctx->graph;
+	size_t degrees = 0;
+
+	if (ctx->values != NULL)
+		return (size_t) (end - begin) * (10 + 1 + 20 + 1);
+	if (ctx->doubles != NULL)
+		return (size_t) (end - begin) * (10 + 1 + EXPORT_DOUBLE_LEN + 1);
+	if (ctx->tree)
+		return (size_t) (end - begin) * (10 + 1 + 10 + 1 + 10 + 1);
+
+	degrees = graph->offsets[end] - graph->offsets[begin];
+	if (ctx->format == OS_EXPORT_ADJACENCY)
+		return (size_t) (end - begin) * (1 + 10 + 3 + 1) + degrees * (10 + 1);
+
+	return degrees * (10 + 1 + 10 + 1);
+}
+
+static char *format_node(export_ctx_t *ctx, char *p, unsigned int idx)
+{
+	os_graph_t *graph = ctx->graph;
+	unsigned int *neighbours;
+	unsigned int self_loops = 0;
+
+	if (ctx->values != NULL) {
+		p = format_ulong(p, idx);
+		*p++ = ' ';
+		p = format_long(p, ctx->values[idx]);
+		*p++ = '\n';
+		return p;
+	}
+
+	if (ctx->doubles != NULL) {
+		p = format_ulong(p, idx);
+		*p++ = ' ';
+		// The terminator lands where the newline goes
+		p += snprintf(p, EXPORT_DOUBLE_LEN + 1, "%.*g", DBL_DECIMAL_DIG,
+			      ctx->doubles[idx]);
+		*p++ = '\n';
+		return p;
+	}
+
+	if (ctx->tree) {
+		const unsigned int *reached = ctx->parent != NULL ? ctx->parent : ctx->level;
+
+		if (reached[idx] == OS_TRAVERSE_UNREACHED)
+			return p;
+		p = format_ulong(p, idx);
+		if (ctx->parent != NULL) {
+			*p++ = ' ';
+			p = format_ulong(p, ctx->parent[idx]);
+		}
+		if (ctx->level != NULL) {
+			*p++ = ' ';
+			p = format_ulong(p, ctx->level[idx]);
+		}
+		*p++ = '\n';
+		return p;
+	}
+
+	// The out-neighbours of a node of an undirected graph are all of them
+	neighbours = graph_out_neighbours(graph, idx);
+
+	if (ctx->format == OS_EXPORT_ADJACENCY) {
+		*p++ = '[';
+		p = format_ulong(p, idx);
+		*p++ = ']';
+		*p++ = ':';
+		*p++ = ' ';
+		for (unsigned int i = 0; i < graph_out_degree(graph, idx); i++) {
+			p = format_ulong(p, neighbours[i]);
+			*p++ = ' ';
+		}
+		*p++ = '\n';
+		return p;
+	}
+
+	/*
+	 * A directed edge is printed once, from the out-list of its source.
+	 * Undirected edges are stored twice, print them from their smaller end.
+	 */
+	for (unsigned int i = 0; i < graph_out_degree(graph, idx); i++) {
+		if (graph->out_ends == NULL) {
+			if (neighbours[i] < idx)
+				continue;
+			// Both copies of a self loop are in the same list
+			if (neighbours[i] == idx && self_loops++ % 2 == 1)
+				continue;
+		}
+		p = format_ulong(p, idx);
+		*p++ = ' ';
+		p = format_ulong(p, neighbours[i]);
+		*p++ = '\n';
+	}
+
+	return p;
+}
+
+/* Format chunks [begin, end) of the current window. */
+static void format_chunks(void *arg, unsigned int begin, unsigned int end)
+{
+	export_ctx_t *ctx = arg;
+
+	for (unsigned int c = begin; c < end; c++) {
+		export_buf_t *buf = &ctx->bufs[c];
+		unsigned int first = ctx->first_node + c * EXPORT_CHUNK_NODES;
+		unsigned int last = ctx->num_nodes - first < EXPORT_CHUNK_NODES ?
+			ctx->num_nodes : first + EXPORT_CHUNK_NODES;
+		size_t bound = chunk_bound(ctx, first, last);
+		char *p;
+
+		if (bound > buf->cap) {
+			char *data = realloc(buf->data, bound);
+
+			if (data == NULL) {
+				__atomic_store_n(&ctx->error, -ENOMEM, __ATOMIC_RELAXED);
+				buf->len = 0;
+				continue;
+			}
+			buf->data = data;
+			buf->cap = bound;
+		}
+
+		p = buf->data;
+		for (unsigned int idx = first; idx < last; idx++)
+			p = format_node(ctx, p, idx);
+		buf->len = p - buf->data;
+	}
+}
+
+/*
+ * Write a vector of buffers entirely, at offset if it is not negative,
+ * at the current file position otherwise. The vector is modified.
+ */
+static int write_all(int fd, struct iovec *iov, int count, off_t offset)
+{
+	while (count > 0) {
+		int batch = count < EXPORT_MAX_IOV ? count : EXPORT_MAX_IOV;
+		ssize_t n;
+
+		if (offset >= 0)
+			n = pwritev(fd, iov, batch, offset);
+		else
+			n = writev(fd, iov, batch);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (offset >= 0)
+			offset += n;
+
+		// Skip what was written
+		while (count > 0 && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/* Return the current offset of fd if it is a regular file, -1 otherwise. */
+static off_t seekable_offset(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+
+	return lseek(fd, 0, SEEK_CUR);
+}
+
+static int export_text(os_threadpool_t *tp, export_ctx_t *ctx, int fd)
+{
+	unsigned int num_chunks;
+	off_t offset = seekable_offset(fd);
+	int rc = 0;
+
+	num_chunks = ctx->num_nodes / EXPORT_CHUNK_NODES +
+		(ctx->num_nodes % EXPORT_CHUNK_NODES != 0);
+
+	for (unsigned int w = 0; w < num_chunks && rc == 0; w += EXPORT_WINDOW_CHUNKS) {
+		unsigned int count = num_chunks - w < EXPORT_WINDOW_CHUNKS ?
+			num_chunks - w : EXPORT_WINDOW_CHUNKS;
+		struct iovec iov[EXPORT_WINDOW_CHUNKS];
+		size_t len = 0;
+
+		ctx->first_node = w * EXPORT_CHUNK_NODES;
+		parallel_for(tp, count, 1, format_chunks, ctx);
+		if (ctx->error < 0) {
+			rc = ctx->error;
+			break;
+		}
+
+		for (unsigned int c = 0; c < count; c++) {
+			iov[c].iov_base = ctx->bufs[c].data;
+			iov[c].iov_len = ctx->bufs[c].len;
+			len += ctx->bufs[c].len;
+		}
+
+		rc = write_all(fd, iov, count, offset);
+		if (offset >= 0)
+			offset += len;
+	}
+
+	// Leave the file position after the output, as a plain write would
+	if (rc == 0 && offset >= 0 && lseek(fd, offset, SEEK_SET) < 0)
+		rc = -errno;
+
+	for (unsigned int c = 0; c < EXPORT_WINDOW_CHUNKS; c++)
+		free(ctx->bufs[c].data);
+
+	return rc;
+}
+
+/* Dump the arrays of the graph as an image, straight from memory. */
+static int export_binary(os_graph_t *graph, int fd)
+{
+	static const char zeros[64];
+	os_graph_image_t hdr;
+	struct iovec iov[10];
+	struct {
+		uint64_t off;
+		const void *data;
+		size_t len;
+	} parts[5];
+	uint64_t pos = 0;
+	off_t offset;
+	int num_parts = 4, count = 0, rc;
+
+	graph_image_layout(graph, &hdr);
+	hdr.magic = OS_GRAPH_IMAGE_MAGIC;
+
+	parts[0].off = 0;
+	parts[0].data = &hdr;
+	parts[0].len = sizeof(hdr);
+	parts[1].off = hdr.offsets_off;
+	parts[1].data = graph->offsets;
+	parts[1].len = ((size_t) graph->num_nodes + 1) * sizeof(*graph->offsets);
+	parts[2].off = hdr.neighbours_off;
+	parts[2].data = graph->neighbours;
+	parts[2].len = 2 * (size_t) graph->num_edges * sizeof(*graph->neighbours);
+	parts[3].off = hdr.info_off;
+	parts[3].data = graph->info;
+	parts[3].len = (size_t) graph->num_nodes * sizeof(*graph->info);
+	if (graph->out_ends != NULL) {
+		parts[4].off = hdr.out_ends_off;
+		parts[4].data = graph->out_ends;
+		parts[4].len = (size_t) graph->num_nodes * sizeof(*graph->out_ends);
+		num_parts++;
+	}
+
+	for (int i = 0; i < num_parts; i++) {
+		// Alignment padding is shorter than a cache line
+		if (parts[i].off > pos) {
+			iov[count].iov_base = (void *) zeros;
+			iov[count++].iov_len = parts[i].off - pos;
+		}
+		iov[count].iov_base = (void *) parts[i].data;
+		iov[count++].iov_len = parts[i].len;
+		pos = parts[i].off + parts[i].len;
+	}
+	if (hdr.size > pos) {
+		iov[count].iov_base = (void *) zeros;
+		iov[count++].iov_len = hdr.size - pos;
+	}
+
+	offset = seekable_offset(fd);
+	rc = write_all(fd, iov, count, offset);
+	if (rc == 0 && offset >= 0 && lseek(fd, offset + hdr.size, SEEK_SET) < 0)
+		rc = -errno;
+
+	return rc;
+}
+
+static unsigned char *put_varint(unsigned char *p, uint32_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+
+	return p;
+}
+
+static inline uint32_t zigzag(uint32_t v)
+{
+	return (v << 1) ^ -(v >> 31);
+}
+
+/* Compress blocks [begin, end) into their own buffers. */
+static void compress_blocks(void *arg, unsigned int begin, unsigned int end)
+{
+	export_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+
+	for (unsigned int b = begin; b < end; b++) {
+		export_buf_t *buf = &ctx->blocks[b];
+		unsigned int first = b * OS_GRAPH_COMPRESS_BLOCK_NODES;
+		unsigned int last = graph->num_nodes - first < OS_GRAPH_COMPRESS_BLOCK_NODES ?
+			graph->num_nodes : first + OS_GRAPH_COMPRESS_BLOCK_NODES;
+		size_t bound = (size_t) (last - first) * 15 +
+			(size_t) (graph->offsets[last] - graph->offsets[first]) * 5;
+		unsigned char *p;
+
+		buf->data = malloc(bound);
+		if (buf->data == NULL) {
+			__atomic_store_n(&ctx->error, -ENOMEM, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		p = (unsigned char *) buf->data;
+		for (unsigned int idx = first; idx < last; idx++) {
+			unsigned int *neighbours = graph_neighbours(graph, idx);
+			uint32_t prev = idx;
+
+			p = put_varint(p, graph_degree(graph, idx));
+			if (graph->out_ends != NULL)
+				p = put_varint(p, graph_out_degree(graph, idx));
+			p = put_varint(p, zigzag(graph->info[idx]));
+			for (unsigned int i = 0; i < graph_degree(graph, idx); i++) {
+				p = put_varint(p, zigzag(neighbours[i] - prev));
+				prev = neighbours[i];
+			}
+		}
+		buf->len = p - (unsigned char *) buf->data;
+	}
+}
+
+/*
+ * Compress all blocks in parallel, then write the header, the index and
+ * the blocks with a single vectored write.
+ */
+static int export_compressed(os_threadpool_t *tp, export_ctx_t *ctx, int fd)
+{
+	os_graph_t *graph = ctx->graph;
+	os_graph_compress_hdr_t hdr;
+	os_graph_block_t *index = NULL;
+	struct iovec *iov = NULL;
+	uint64_t pos, size;
+	off_t offset;
+	int rc;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = OS_GRAPH_COMPRESS_MAGIC;
+	hdr.version = OS_GRAPH_COMPRESS_VERSION;
+	hdr.block_nodes = OS_GRAPH_COMPRESS_BLOCK_NODES;
+	hdr.num_nodes = graph->num_nodes;
+	hdr.num_edges = graph->num_edges;
+	hdr.num_blocks = graph->num_nodes / OS_GRAPH_COMPRESS_BLOCK_NODES +
+		(graph->num_nodes % OS_GRAPH_COMPRESS_BLOCK_NODES != 0);
+	if (graph->out_ends != NULL)
+		hdr.flags = OS_GRAPH_COMPRESS_DIRECTED;
+
+	ctx->blocks = calloc(hdr.num_blocks + 1, sizeof(*ctx->blocks));
+	index = malloc((hdr.num_blocks + 1) * sizeof(*index));
+	iov = malloc((hdr.num_blocks + 2) * sizeof(*iov));
+	if (ctx->blocks == NULL || index == NULL || iov == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	parallel_for(tp, hdr.num_blocks, 1, compress_blocks, ctx);
+	rc = ctx->error;
+	if (rc < 0)
+		goto out;
+
+	pos = sizeof(hdr) + (uint64_t) hdr.num_blocks * sizeof(*index);
+	for (unsigned int b = 0; b < hdr.num_blocks; b++) {
+		index[b].offset = pos;
+		index[b].size = ctx->blocks[b].len;
+		index[b].first_edge = graph->offsets[b * OS_GRAPH_COMPRESS_BLOCK_NODES];
+		if (ctx->blocks[b].len > hdr.max_block_size)
+			hdr.max_block_size = ctx->blocks[b].len;
+		pos += ctx->blocks[b].len;
+
+		iov[b + 2].iov_base = ctx->blocks[b].data;
+		iov[b + 2].iov_len = ctx->blocks[b].len;
+	}
+	size = pos;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = index;
+	iov[1].iov_len = hdr.num_blocks * sizeof(*index);
+
+	offset = seekable_offset(fd);
+	rc = write_all(fd, iov, hdr.num_blocks + 2, offset);
+	if (rc == 0 && offset >= 0 && lseek(fd, offset + size, SEEK_SET) < 0)
+		rc = -errno;
+
+out:
+	if (ctx->blocks != NULL) {
+		for (unsigned int b = 0; b < hdr.num_blocks; b++)
+			free(ctx->blocks[b].data);
+		free(ctx->blocks);
+	}
+	free(index);
+	free(iov);
+
+	return rc;
+}
+
+int export_graph(os_threadpool_t *tp, os_graph_t *graph, os_export_format_t format,
+		int fd)
+{
+	export_ctx_t ctx;
+
+	if (format == OS_EXPORT_BINARY)
+		return export_binary(graph, fd);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.graph = graph;
+	ctx.format = format;
+	ctx.num_nodes = graph->num_nodes;
+
+	if (format == OS_EXPORT_COMPRESSED)
+		return export_compressed(tp, &ctx, fd);
+
+	return export_text(tp, &ctx, fd);
+}
+
+/* Export one "node value" line per node. */
+int export_node_values(os_threadpool_t *tp, const long long *values,
+		unsigned int num_nodes, int fd)
+{
+	export_ctx_t ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.values = values;
+	ctx.num_nodes = num_nodes;
+
+	return export_text(tp, &ctx, fd);
+}
+
+/* Export one "node value" line per node, exact enough to read back the value. */
+int export_node_doubles(os_threadpool_t *tp, const double *values,
+		unsigned int num_nodes, int fd)
+{
+	export_ctx_t ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.doubles = values;
+	ctx.num_nodes = num_nodes;
+
+	return export_text(tp, &ctx, fd);
+}
+
+/*
+ * Export one "node parent level" line per node reached by a traversal.
+ * Either array may be NULL, its column is left out then.
+ */
+int export_bfs_tree(os_threadpool_t *tp, const unsigned int *parent,
+		const unsigned int *level, unsigned int num_nodes, int fd)
+{
+	export_ctx_t ctx;
+
+	if (parent == NULL && level == NULL)
+		return -EINVAL;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.parent = parent;
+	ctx.level = level;
+	ctx.tree = true;
+	ctx.num_nodes = num_nodes;
+
+	return export_text(tp, &ctx, fd);
+}
+
+int export_format_from_name(const char *name)
+{
+	if (strcmp(name, "adjacency") == 0)
+		return OS_EXPORT_ADJACENCY;
+	if (strcmp(name, "edges") == 0)
+		return OS_EXPORT_EDGE_LIST;
+	if (strcmp(name, "binary") == 0)
+		return OS_EXPORT_BINARY;
+	if (strcmp(name, "compressed") == 0)
+		return OS_EXPORT_COMPRESSED;
+
+	return -EINVAL;
+}
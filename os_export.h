@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_EXPORT_H__
+#define __OS_EXPORT_H__	1
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+typedef enum {
+	OS_EXPORT_ADJACENCY,	// "[node]: neighbours" lines, as print_graph()
+	OS_EXPORT_EDGE_LIST,	// "src dst" lines, one per edge
+	OS_EXPORT_BINARY,	// graph image, see os_graph_image.h
+	OS_EXPORT_COMPRESSED,	// block compressed, see os_graph_compress.h
+} os_export_format_t;
+
+/*
+ * Exporters format the output in per-chunk buffers, in parallel on tp
+ * (serially if tp is NULL), and hand each window of chunks to a single
+ * pwritev() at its precomputed offset, or writev() if fd is not seekable.
+ * They return 0 or a negative errno value.
+ */
+int export_graph(os_threadpool_t *tp, os_graph_t *graph, os_export_format_t format,
+		int fd);
+int export_node_values(os_threadpool_t *tp, const long long *values,
+		unsigned int num_nodes, int fd);
+int export_node_doubles(os_threadpool_t *tp, const double *values,
+		unsigned int num_nodes, int fd);
+int export_bfs_tree(os_threadpool_t *tp, const unsigned int *parent,
+		const unsigned int *level, unsigned int num_nodes, int fd);
+int export_format_from_name(const char *name);
+
+#endif
@@ -2,63 +2,130 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "os_graph.h"
+#include "os_graph_parse.h"
+#include "os_export.h"
 #include "log/log.h"
-#include "utils.h"
 
-/* Node functions */
-os_node_t *os_create_node(unsigned int id, int info)
+/* Graph functions */
+
+/*
+ * Allocate a graph and its arrays, for loaders filling them in place.
+ * Only the offsets are zeroed.
+ */
+os_graph_t *create_graph(unsigned int num_nodes, unsigned int num_edges)
 {
-	os_node_t *node;
+	os_graph_t *graph;
 
-	node = malloc(sizeof(*node));
-	DIE(node == NULL, "mallloc");
+	graph = calloc(1, sizeof(*graph));
+	if (graph == NULL)
+		return NULL;
+
+	graph->num_nodes = num_nodes;
+	graph->num_edges = num_edges;
 
-	node->id = id;
-	node->info = info;
-	node->num_neighbours = 0;
-	node->neighbours = NULL;
+	graph->info = malloc(num_nodes * sizeof(*graph->info));
+	graph->offsets = calloc((size_t) num_nodes + 1, sizeof(*graph->offsets));
+	graph->neighbours = malloc(2 * (size_t) num_edges * sizeof(*graph->neighbours));
+	if (graph->info == NULL || graph->offsets == NULL ||
+	    graph->neighbours == NULL) {
+		destroy_graph(graph);
+		return NULL;
+	}
 
-	return node;
+	return graph;
 }
 
-/* Graph functions */
 os_graph_t *create_graph_from_data(unsigned int num_nodes, unsigned int num_edges,
 		int *values, os_edge_t *edges)
 {
 	os_graph_t *graph;
+	unsigned int *pos;
 
-	graph = malloc(sizeof(*graph));
-	DIE(graph == NULL, "mallloc");
+	graph = create_graph(num_nodes, num_edges);
+	if (graph == NULL)
+		return NULL;
 
-	graph->num_nodes = num_nodes;
-	graph->num_edges = num_edges;
+	pos = malloc(num_nodes * sizeof(*pos));
+	if (pos == NULL) {
+		destroy_graph(graph);
+		return NULL;
+	}
 
-	graph->nodes = malloc(num_nodes * sizeof(os_node_t *));
-	DIE(graph->nodes == NULL, "malloc");
+	memcpy(graph->info, values, num_nodes * sizeof(*graph->info));
 
-	for (unsigned int i = 0; i < graph->num_nodes; i++) {
-		graph->nodes[i] = os_create_node(i, values[i]);
-		graph->nodes[i]->neighbours = malloc(graph->num_nodes * sizeof(unsigned int));
-		DIE(graph->nodes[i]->neighbours == NULL, "malloc");
-		graph->nodes[i]->num_neighbours = 0;
+	// Count the degrees, shifted by one so the prefix sum gives the offsets
+	for (unsigned int i = 0; i < num_edges; i++) {
+		graph->offsets[edges[i].src + 1]++;
+		graph->offsets[edges[i].dst + 1]++;
 	}
+	for (unsigned int i = 0; i < num_nodes; i++)
+		graph->offsets[i + 1] += graph->offsets[i];
+
+	memcpy(pos, graph->offsets, num_nodes * sizeof(*pos));
 
-	for (unsigned int i = 0; i < graph->num_edges; i++) {
+	for (unsigned int i = 0; i < num_edges; i++) {
 		unsigned int isrc, idst;
 
 		isrc = edges[i].src;
 		idst = edges[i].dst;
-		graph->nodes[isrc]->neighbours[graph->nodes[isrc]->num_neighbours++] = idst;
-		graph->nodes[idst]->neighbours[graph->nodes[idst]->num_neighbours++] = isrc;
+		graph->neighbours[pos[isrc]++] = idst;
+		graph->neighbours[pos[idst]++] = isrc;
 	}
 
-	graph->visited = malloc(graph->num_nodes * sizeof(*graph->visited));
-	DIE(graph->visited == NULL, "malloc");
+	free(pos);
 
-	for (unsigned int i = 0; i < graph->num_nodes; i++)
-		graph->visited[i] = NOT_VISITED;
+	return graph;
+}
+
+/*
+ * Build a directed graph: the out-neighbours are scattered first, each list
+ * filled from its start, then the in-neighbours, from out_ends[i] on.
+ */
+os_graph_t *create_digraph_from_data(unsigned int num_nodes, unsigned int num_edges,
+		int *values, os_edge_t *edges)
+{
+	os_graph_t *graph;
+	unsigned int *pos;
+
+	graph = create_graph(num_nodes, num_edges);
+	if (graph == NULL)
+		return NULL;
+
+	pos = malloc(((size_t) num_nodes + 1) * sizeof(*pos));
+	graph->out_ends = calloc((size_t) num_nodes + 1, sizeof(*graph->out_ends));
+	if (pos == NULL || graph->out_ends == NULL) {
+		free(pos);
+		destroy_graph(graph);
+		return NULL;
+	}
+
+	memcpy(graph->info, values, num_nodes * sizeof(*graph->info));
+
+	for (unsigned int i = 0; i < num_edges; i++) {
+		graph->offsets[edges[i].src + 1]++;
+		graph->offsets[edges[i].dst + 1]++;
+		graph->out_ends[edges[i].src]++;
+	}
+	for (unsigned int i = 0; i < num_nodes; i++) {
+		graph->offsets[i + 1] += graph->offsets[i];
+		graph->out_ends[i] += graph->offsets[i];
+	}
+
+	memcpy(pos, graph->offsets, num_nodes * sizeof(*pos));
+	for (unsigned int i = 0; i < num_edges; i++)
+		graph->neighbours[pos[edges[i].src]++] = edges[i].dst;
+
+	memcpy(pos, graph->out_ends, num_nodes * sizeof(*pos));
+	for (unsigned int i = 0; i < num_edges; i++)
+		graph->neighbours[pos[edges[i].dst]++] = edges[i].src;
+
+	free(pos);
 
 	return graph;
 }
@@ -71,30 +138,42 @@ os_graph_t *create_graph_from_file(FILE *file)
 	os_edge_t *edges;
 	os_graph_t *graph = NULL;
 
-	if (fscanf(file, "%d %d", &num_nodes, &num_edges) == 0) {
+	if (fscanf(file, "%u %u", &num_nodes, &num_edges) != 2) {
 		log_error("Can't read from file");
 		goto out;
 	}
 
 	nodes = malloc(num_nodes * sizeof(int));
-	DIE(nodes == NULL, "malloc");
+	if (nodes == NULL) {
+		log_error("Not enough memory for %u nodes", num_nodes);
+		goto out;
+	}
 	for (i = 0; i < num_nodes; i++) {
-		if (fscanf(file, "%d", &nodes[i]) == 0) {
+		if (fscanf(file, "%d", &nodes[i]) != 1) {
 			log_error("Can't read from file");
 			goto free_nodes;
 		}
 	}
 
 	edges = malloc(num_edges * sizeof(os_edge_t));
-	DIE(edges == NULL, "malloc");
+	if (edges == NULL) {
+		log_error("Not enough memory for %u edges", num_edges);
+		goto free_nodes;
+	}
 	for (i = 0; i < num_edges; ++i) {
-		if (fscanf(file, "%d %d", &edges[i].src, &edges[i].dst) == 0) {
+		if (fscanf(file, "%u %u", &edges[i].src, &edges[i].dst) != 2) {
 			log_error("Can't read from file");
 			goto free_edges;
 		}
+		if (edges[i].src >= num_nodes || edges[i].dst >= num_nodes) {
+			log_error("Invalid edge %u %u", edges[i].src, edges[i].dst);
+			goto free_edges;
+		}
 	}
 
 	graph = create_graph_from_data(num_nodes, num_edges, nodes, edges);
+	if (graph == NULL)
+		log_error("Not enough memory for the graph");
 
 free_edges:
 	free(edges);
@@ -104,12 +183,166 @@ out:
 	return graph;
 }
 
-void print_graph(os_graph_t *graph)
+// Parsed text of a mapped file is dropped by steps of this size
+#define TEXT_RELEASE_STEP	(8UL << 20)
+
+/*
+ * Drop the pages of a mapped file before p from memory, once there are
+ * enough of them. They are read back from the page cache if accessed again.
+ */
+static const char *release_text(const char *released, const char *p)
 {
-	for (unsigned int i = 0; i < graph->num_nodes; i++) {
-		printf("[%d]: ", i);
-		for (unsigned int j = 0; j < graph->nodes[i]->num_neighbours; j++)
-			printf("%d ", graph->nodes[i]->neighbours[j]);
-		printf("\n");
+	uintptr_t start = (uintptr_t) released, stop;
+
+	if (p == NULL || (size_t) (p - released) < TEXT_RELEASE_STEP)
+		return released;
+
+	stop = (uintptr_t) p & ~((uintptr_t) sysconf(_SC_PAGESIZE) - 1);
+	madvise((void *) start, stop - start, MADV_DONTNEED);
+
+	return (const char *) stop;
+}
+
+/*
+ * Build a graph from the text of a graph file held in memory, without
+ * intermediate arrays. The header gives the sizes of the final arrays: the
+ * node values are parsed straight into them, a first pass over the edges
+ * counts the degrees and a second one scatters the edges into their
+ * adjacency lists. If mapped is set, data must be a page aligned read-only
+ * file mapping, whose parsed pages are dropped along the way to keep the
+ * memory use close to the size of the graph. If directed is set, the graph
+ * keeps the direction of the edges.
+ */
+os_graph_t *create_graph_from_text(const char *data, size_t size, bool mapped,
+		bool directed)
+{
+	const char *p = data, *end = data + size, *edges_start;
+	const char *released = data;
+	unsigned int num_nodes, num_edges, src, dst;
+	unsigned int *offsets, *out_ends = NULL;
+	os_graph_t *graph;
+
+	p = parse_uint(p, end, &num_nodes);
+	if (p != NULL)
+		p = parse_uint(p, end, &num_edges);
+	if (p == NULL) {
+		log_error("Can't read from file");
+		return NULL;
+	}
+
+	graph = create_graph(num_nodes, num_edges);
+	if (graph == NULL) {
+		log_error("Not enough memory for the graph");
+		return NULL;
+	}
+	offsets = graph->offsets;
+
+	if (directed) {
+		out_ends = calloc((size_t) num_nodes + 1, sizeof(*out_ends));
+		if (out_ends == NULL) {
+			log_error("Not enough memory for the graph");
+			goto error;
+		}
+		graph->out_ends = out_ends;
+	}
+
+	for (unsigned int i = 0; i < num_nodes && p != NULL; i++) {
+		p = parse_int(p, end, &graph->info[i]);
+		if (mapped && i % 4096 == 0)
+			released = release_text(released, p);
+	}
+	if (p == NULL)
+		goto parse_error;
+
+	/*
+	 * The degree of node i is counted in offsets[i + 2], so that after the
+	 * prefix sum offsets[i + 1] is the start of the list of node i, and
+	 * after the scatter, its end. The last node needs no counter.
+	 */
+	edges_start = p;
+	for (unsigned int i = 0; i < num_edges; i++) {
+		p = parse_uint(p, end, &src);
+		if (p != NULL)
+			p = parse_uint(p, end, &dst);
+		if (p == NULL)
+			goto parse_error;
+		if (src >= num_nodes || dst >= num_nodes) {
+			log_error("Invalid edge %u %u", src, dst);
+			goto error;
+		}
+		if (src + 2 <= num_nodes)
+			offsets[src + 2]++;
+		if (dst + 2 <= num_nodes)
+			offsets[dst + 2]++;
+		if (directed)
+			out_ends[src]++;
+		if (mapped && i % 4096 == 0)
+			released = release_text(released, p);
 	}
+	for (unsigned int i = 2; i <= num_nodes; i++)
+		offsets[i] += offsets[i - 1];
+
+	/*
+	 * Directed graphs fill the in-neighbours of node i from out_ends[i],
+	 * set here to the end of its out-neighbours.
+	 */
+	for (unsigned int i = 0; directed && i < num_nodes; i++)
+		out_ends[i] += offsets[i + 1];
+
+	// The edges were checked by the first pass
+	p = edges_start;
+	released = (const char *) ((uintptr_t) p &
+		~((uintptr_t) sysconf(_SC_PAGESIZE) - 1));
+	for (unsigned int i = 0; i < num_edges; i++) {
+		p = parse_uint(p, end, &src);
+		p = parse_uint(p, end, &dst);
+		graph->neighbours[offsets[src + 1]++] = dst;
+		if (directed)
+			graph->neighbours[out_ends[dst]++] = src;
+		else
+			graph->neighbours[offsets[dst + 1]++] = src;
+		if (mapped && i % 4096 == 0)
+			released = release_text(released, p);
+	}
+
+	/*
+	 * The cursors of the out-neighbours stopped at the end of the
+	 * out-neighbours, those of the in-neighbours at the start of the next
+	 * list: swap them into place.
+	 */
+	for (unsigned int i = 0; directed && i < num_nodes; i++) {
+		unsigned int tmp = offsets[i + 1];
+
+		offsets[i + 1] = out_ends[i];
+		out_ends[i] = tmp;
+	}
+
+	return graph;
+
+parse_error:
+	log_error("Can't read from file");
+error:
+	destroy_graph(graph);
+	return NULL;
+}
+
+void destroy_graph(os_graph_t *graph)
+{
+	if (graph->mapping != NULL) {
+		munmap(graph->mapping, graph->mapping_size);
+	} else {
+		free(graph->info);
+		free(graph->offsets);
+		free(graph->neighbours);
+		free(graph->out_ends);
+	}
+
+	free(graph);
+}
+
+void print_graph(os_graph_t *graph)
+{
+	// The exporter writes to the file descriptor, flush what stdio holds
+	fflush(stdout);
+	export_graph(NULL, graph, OS_EXPORT_ADJACENCY, STDOUT_FILENO);
 }
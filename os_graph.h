@@ -4,35 +4,88 @@
 #define __OS_GRAPH_H__	1
 
 #include <stdio.h>
-
-typedef struct os_node_t {
-	unsigned int id;
-	int info;
-
-	unsigned int num_neighbours;
-	unsigned int *neighbours;
-} os_node_t;
+#include <stddef.h>
+#include <stdbool.h>
 
 typedef struct os_graph_t {
 	unsigned int num_nodes;
 	unsigned int num_edges;
 
-	os_node_t **nodes;
-	enum {
-		NOT_VISITED = 0,
-		PROCESSING = 1,
-		DONE = 2
-	} *visited;
+	/*
+	 * Compressed sparse row adjacency: the neighbours of node i are
+	 * neighbours[offsets[i]] up to neighbours[offsets[i + 1] - 1].
+	 * Every edge is stored in both directions.
+	 */
+	int *info;
+	unsigned int *offsets;
+	unsigned int *neighbours;
+
+	/*
+	 * Directed graphs keep the direction of their edges: the list of node
+	 * i holds its out-neighbours, up to out_ends[i], then its
+	 * in-neighbours. Algorithms for undirected graphs see every edge in
+	 * both directions as usual. NULL for undirected graphs.
+	 */
+	unsigned int *out_ends;
+
+	// Read-only mapping holding the arrays above, NULL if heap allocated
+	void *mapping;
+	size_t mapping_size;
 } os_graph_t;
 
 typedef struct os_edge_t {
 	unsigned int src, dst;
 } os_edge_t;
 
-os_node_t *os_create_node(unsigned int id, int info);
+os_graph_t *create_graph(unsigned int num_nodes, unsigned int num_edges);
 os_graph_t *create_graph_from_data(unsigned int num_nodes, unsigned int num_edges,
 		int *values, os_edge_t *edges);
+os_graph_t *create_digraph_from_data(unsigned int num_nodes, unsigned int num_edges,
+		int *values, os_edge_t *edges);
 os_graph_t *create_graph_from_file(FILE *file);
+os_graph_t *create_graph_from_text(const char *data, size_t size, bool mapped,
+		bool directed);
+void destroy_graph(os_graph_t *graph);
 void print_graph(os_graph_t *graph);
 
+static inline unsigned int graph_degree(os_graph_t *graph, unsigned int idx)
+{
+	return graph->offsets[idx + 1] - graph->offsets[idx];
+}
+
+static inline unsigned int *graph_neighbours(os_graph_t *graph, unsigned int idx)
+{
+	return graph->neighbours + graph->offsets[idx];
+}
+
+/*
+ * Out- and in-neighbours of a node; in an undirected graph, both are all
+ * its neighbours.
+ */
+static inline unsigned int graph_out_degree(os_graph_t *graph, unsigned int idx)
+{
+	if (graph->out_ends == NULL)
+		return graph_degree(graph, idx);
+	return graph->out_ends[idx] - graph->offsets[idx];
+}
+
+static inline unsigned int *graph_out_neighbours(os_graph_t *graph, unsigned int idx)
+{
+	return graph->neighbours + graph->offsets[idx];
+}
+
+static inline unsigned int graph_in_degree(os_graph_t *graph, unsigned int idx)
+{
+	if (graph->out_ends == NULL)
+		return graph_degree(graph, idx);
+	return graph->offsets[idx + 1] - graph->out_ends[idx];
+}
+
+static inline unsigned int *graph_in_neighbours(os_graph_t *graph, unsigned int idx)
+{
+	if (graph->out_ends == NULL)
+		return graph_neighbours(graph, idx);
+	return graph->neighbours + graph->out_ends[idx];
+}
+
 #endif
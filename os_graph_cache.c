@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "os_graph_cache.h"
+#include "os_graph_image.h"
+#include "os_export.h"
+#include "log/log.h"
+
+// Bytes of the input read at once when hashing it
+#define CACHE_READ_SIZE		(1 << 20)
+#define CACHE_HASH_LANES	4
+
+static char *cache_path(const char *path)
+{
+	size_t len = strlen(path);
+	char *cpath;
+
+	cpath = malloc(len + sizeof(OS_GRAPH_CACHE_SUFFIX));
+	if (cpath == NULL)
+		return NULL;
+	memcpy(cpath, path, len);
+	memcpy(cpath + len, OS_GRAPH_CACHE_SUFFIX, sizeof(OS_GRAPH_CACHE_SUFFIX));
+
+	return cpath;
+}
+
+static inline uint64_t mix_word(uint64_t h, uint64_t w)
+{
+	h ^= w * 0x9e3779b97f4a7c15ULL;
+	h = (h << 31) | (h >> 33);
+	return h * 0xff51afd7ed558ccdULL;
+}
+
+/*
+ * Hash a buffer whose length is a multiple of CACHE_HASH_LANES words.
+ * The words are spread over independent lanes, so the multiplications of
+ * consecutive words overlap and hashing keeps up with reading.
+ */
+static void hash_words(uint64_t *lanes, const uint64_t *words, size_t count)
+{
+	for (size_t i = 0; i < count; i += CACHE_HASH_LANES)
+		for (unsigned int j = 0; j < CACHE_HASH_LANES; j++)
+			lanes[j] = mix_word(lanes[j], words[i + j]);
+}
+
+/*
+ * Compute the key of an input file, hashing its whole content: a same-size
+ * edit keeping the modification time, as cp -p or rsync -t do, must not
+ * match the cache of the previous content.
+ */
+static int compute_key(int fd, os_graph_cache_key_t *key)
+{
+	const size_t block = CACHE_HASH_LANES * sizeof(uint64_t);
+	uint64_t lanes[CACHE_HASH_LANES], *buf, tail[CACHE_HASH_LANES];
+	size_t len = 0;
+	struct stat st;
+	ssize_t n;
+	int rc = 0;
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	buf = malloc(CACHE_READ_SIZE);
+	if (buf == NULL)
+		return -ENOMEM;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	memset(key, 0, sizeof(*key));
+	key->magic = OS_GRAPH_CACHE_MAGIC;
+	key->size = st.st_size;
+	key->mtime_sec = st.st_mtim.tv_sec;
+	key->mtime_nsec = st.st_mtim.tv_nsec;
+	for (unsigned int j = 0; j < CACHE_HASH_LANES; j++)
+		lanes[j] = 0xcbf29ce484222325ULL + j;
+
+	// Full blocks are hashed as they come, a partial one is kept for later
+	for (;;) {
+		n = read(fd, (char *) buf + len, CACHE_READ_SIZE - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			rc = -errno;
+			goto out;
+		}
+		if (n == 0)
+			break;
+		len += n;
+		hash_words(lanes, buf, len / block * CACHE_HASH_LANES);
+		memmove(buf, (char *) buf + len / block * block, len % block);
+		len %= block;
+	}
+
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, buf, len);
+	hash_words(lanes, tail, CACHE_HASH_LANES);
+
+	key->hash = st.st_size;
+	for (unsigned int j = 0; j < CACHE_HASH_LANES; j++)
+		key->hash = mix_word(key->hash, lanes[j]);
+
+out:
+	free(buf);
+	return rc;
+}
+
+/*
+ * Compute the key of an input, before parsing it, so that an input modified
+ * while being parsed never gets a cache matching its new content.
+ */
+int graph_cache_key(const char *path, os_graph_cache_key_t *key)
+{
+	int fd, rc;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	rc = compute_key(fd, key);
+	close(fd);
+
+	return rc;
+}
+
+/* Map the cache of an input, return NULL if there is no valid one. */
+os_graph_t *graph_cache_open(const char *path, const os_graph_cache_key_t *key)
+{
+	os_graph_cache_key_t stored;
+	os_graph_image_t hdr;
+	os_graph_t *graph = NULL;
+	struct stat st;
+	char *cpath;
+	void *image;
+	int cfd;
+
+	cpath = cache_path(path);
+	if (cpath == NULL)
+		return NULL;
+	cfd = open(cpath, O_RDONLY);
+	free(cpath);
+	if (cfd < 0)
+		return NULL;
+
+	// The key follows the image, which is described by its header
+	if (fstat(cfd, &st) < 0 ||
+	    pread(cfd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    hdr.magic != OS_GRAPH_IMAGE_MAGIC || hdr.version != OS_GRAPH_IMAGE_VERSION ||
+	    (uint64_t) st.st_size != hdr.size + sizeof(stored) ||
+	    pread(cfd, &stored, sizeof(stored), hdr.size) != sizeof(stored) ||
+	    memcmp(&stored, key, sizeof(stored)) != 0) {
+		log_debug("Stale or invalid cache for %s", path);
+		goto out;
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cfd, 0);
+	if (image == MAP_FAILED)
+		goto out;
+
+	// A corrupted cache is rejected here and rewritten like a stale one
+	graph = graph_image_map(image, st.st_size, true);
+	if (graph == NULL)
+		munmap(image, st.st_size);
+
+out:
+	close(cfd);
+	return graph;
+}
+
+/*
+ * Write the cache of an input. The cache is written to a temporary file
+ * renamed over the final one, so concurrent readers either see a complete
+ * cache or none.
+ */
+int graph_cache_store(os_graph_t *graph, const char *path,
+		const os_graph_cache_key_t *key)
+{
+	char *cpath, *tmp_path = NULL;
+	int tfd, rc;
+
+	cpath = cache_path(path);
+	if (cpath == NULL)
+		return -ENOMEM;
+	tmp_path = malloc(strlen(cpath) + 32);
+	if (tmp_path == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	sprintf(tmp_path, "%s.tmp.%d", cpath, (int) getpid());
+
+	tfd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (tfd < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	rc = export_graph(NULL, graph, OS_EXPORT_BINARY, tfd);
+	if (rc == 0 && write(tfd, key, sizeof(*key)) != sizeof(*key))
+		rc = -EIO;
+	// The content must be on disk before the name, or a crash could leave a
+	// complete looking cache holding garbage
+	if (rc == 0 && fsync(tfd) < 0)
+		rc = -errno;
+	if (close(tfd) < 0 && rc == 0)
+		rc = -errno;
+	if (rc == 0 && rename(tmp_path, cpath) < 0)
+		rc = -errno;
+	if (rc < 0)
+		unlink(tmp_path);
+
+out:
+	free(tmp_path);
+	free(cpath);
+	return rc;
+}
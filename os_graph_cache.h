@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_GRAPH_CACHE_H__
+#define __OS_GRAPH_CACHE_H__	1
+
+#include <stdint.h>
+
+#include "os_graph.h"
+
+/*
+ * Binary cache of a parsed text graph, stored next to it as
+ * "<input>.osgc": a graph image (os_graph_image.h) followed by the key of
+ * the input it was built from. A cache is only used if the size, the
+ * modification time and a hash of the content of the input still match.
+ */
+#define OS_GRAPH_CACHE_SUFFIX	".osgc"
+#define OS_GRAPH_CACHE_MAGIC	0x4548434143475348ULL	/* "HSGCACHE" */
+// Smaller inputs parse faster than the cache can be checked
+#define OS_GRAPH_CACHE_MIN_SIZE	(1UL << 20)
+
+typedef struct os_graph_cache_key_t {
+	uint64_t magic;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t hash;
+
+	// Parser settings the cache was built with, set by the caller
+	uint32_t format;
+	int32_t default_value;
+} os_graph_cache_key_t;
+
+int graph_cache_key(const char *path, os_graph_cache_key_t *key);
+os_graph_t *graph_cache_open(const char *path, const os_graph_cache_key_t *key);
+int graph_cache_store(os_graph_t *graph, const char *path,
+		const os_graph_cache_key_t *key);
+
+#endif
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "os_graph_compress.h"
+#include "log/log.h"
+
+typedef struct {
+	int fd;
+	os_graph_compress_hdr_t hdr;
+	os_graph_block_t *index;
+	os_graph_t *graph;
+	int error;
+} decompress_ctx_t;
+
+static int read_full(int fd, void *buf, size_t len, off_t offset)
+{
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = pread(fd, p, len, offset);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (n == 0)
+			return -EIO;
+		p += n;
+		len -= n;
+		offset += n;
+	}
+
+	return 0;
+}
+
+static const unsigned char *get_varint(const unsigned char *p,
+		const unsigned char *end, uint32_t *v)
+{
+	uint32_t value = 0;
+
+	for (unsigned int shift = 0; shift < 35 && p < end; shift += 7) {
+		unsigned char c = *p++;
+
+		value |= (uint32_t) (c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			*v = value;
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static inline uint32_t unzigzag(uint32_t v)
+{
+	return (v >> 1) ^ -(v & 1);
+}
+
+/* Decode a block straight into the arrays of the graph. */
+static int decode_block(decompress_ctx_t *ctx, unsigned int b, unsigned char *buf)
+{
+	os_graph_t *graph = ctx->graph;
+	os_graph_block_t *block = &ctx->index[b];
+	const unsigned char *p = buf, *end = buf + block->size;
+	unsigned int first = b * ctx->hdr.block_nodes;
+	unsigned int last = graph->num_nodes - first < ctx->hdr.block_nodes ?
+		graph->num_nodes : first + ctx->hdr.block_nodes;
+	uint32_t pos = block->first_edge, limit;
+	int rc;
+
+	limit = b + 1 < ctx->hdr.num_blocks ? ctx->index[b + 1].first_edge :
+		2 * graph->num_edges;
+	if (pos > limit || limit > 2 * graph->num_edges)
+		return -EINVAL;
+
+	rc = read_full(ctx->fd, buf, block->size, block->offset);
+	if (rc < 0)
+		return rc;
+
+	for (unsigned int idx = first; idx < last; idx++) {
+		uint32_t degree, out_degree, info, prev = idx;
+
+		p = get_varint(p, end, &degree);
+		if (p == NULL || degree > limit - pos)
+			return -EINVAL;
+		if (graph->out_ends != NULL) {
+			p = get_varint(p, end, &out_degree);
+			if (p == NULL || out_degree > degree)
+				return -EINVAL;
+			graph->out_ends[idx] = pos + out_degree;
+		}
+		p = get_varint(p, end, &info);
+		if (p == NULL)
+			return -EINVAL;
+
+		graph->offsets[idx] = pos;
+		graph->info[idx] = (int) unzigzag(info);
+		for (uint32_t i = 0; i < degree; i++) {
+			uint32_t delta;
+
+			p = get_varint(p, end, &delta);
+			if (p == NULL)
+				return -EINVAL;
+			prev += unzigzag(delta);
+			if (prev >= graph->num_nodes)
+				return -EINVAL;
+			graph->neighbours[pos++] = prev;
+		}
+	}
+
+	// The block must fill its whole part of the neighbours array
+	if (p != end || pos != limit)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void decode_blocks(void *arg, unsigned int begin, unsigned int end)
+{
+	decompress_ctx_t *ctx = arg;
+	unsigned char *buf;
+	int rc = 0;
+
+	buf = malloc(ctx->hdr.max_block_size ? ctx->hdr.max_block_size : 1);
+	if (buf == NULL)
+		rc = -ENOMEM;
+
+	for (unsigned int b = begin; b < end && rc == 0; b++) {
+		if (__atomic_load_n(&ctx->error, __ATOMIC_RELAXED) < 0)
+			break;
+		rc = decode_block(ctx, b, buf);
+	}
+
+	if (rc < 0)
+		__atomic_store_n(&ctx->error, rc, __ATOMIC_RELAXED);
+	free(buf);
+}
+
+static int check_header(decompress_ctx_t *ctx, off_t file_size)
+{
+	os_graph_compress_hdr_t *hdr = &ctx->hdr;
+	uint64_t data_start;
+
+	if (hdr->magic != OS_GRAPH_COMPRESS_MAGIC)
+		return -EINVAL;
+	if (hdr->version != OS_GRAPH_COMPRESS_VERSION) {
+		log_error("Unsupported compressed graph version %u", hdr->version);
+		return -EINVAL;
+	}
+	if (hdr->block_nodes == 0 || hdr->num_edges > UINT32_MAX / 2 ||
+	    (hdr->flags & ~OS_GRAPH_COMPRESS_DIRECTED) != 0 ||
+	    hdr->num_blocks != hdr->num_nodes / hdr->block_nodes +
+	    (hdr->num_nodes % hdr->block_nodes != 0))
+		return -EINVAL;
+
+	data_start = sizeof(*hdr) + (uint64_t) hdr->num_blocks * sizeof(*ctx->index);
+	if ((uint64_t) file_size < data_start)
+		return -EINVAL;
+
+	ctx->index = malloc(hdr->num_blocks * sizeof(*ctx->index) + 1);
+	if (ctx->index == NULL)
+		return -ENOMEM;
+	if (read_full(ctx->fd, ctx->index, hdr->num_blocks * sizeof(*ctx->index),
+		      sizeof(*hdr)) < 0)
+		return -EIO;
+
+	for (unsigned int b = 0; b < hdr->num_blocks; b++) {
+		os_graph_block_t *block = &ctx->index[b];
+
+		if (block->size > hdr->max_block_size || block->offset < data_start ||
+		    block->offset + block->size > (uint64_t) file_size)
+			return -EINVAL;
+	}
+	if (hdr->num_blocks > 0 && ctx->index[0].first_edge != 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Load a block compressed graph file. The blocks are read and decompressed
+ * in parallel on tp (serially if tp is NULL), each straight into its part
+ * of the graph arrays, whose positions come from the block index. A graph
+ * exported as directed is loaded as directed.
+ */
+os_graph_t *graph_compress_load(os_threadpool_t *tp, int fd)
+{
+	decompress_ctx_t ctx;
+	off_t file_size;
+	int rc;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fd = fd;
+
+	file_size = lseek(fd, 0, SEEK_END);
+	if (file_size < 0 || read_full(fd, &ctx.hdr, sizeof(ctx.hdr), 0) < 0) {
+		log_error("Can't read the compressed graph header");
+		return NULL;
+	}
+
+	rc = check_header(&ctx, file_size);
+	if (rc < 0)
+		goto out;
+
+	ctx.graph = create_graph(ctx.hdr.num_nodes, ctx.hdr.num_edges);
+	if (ctx.graph == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	if (ctx.hdr.flags & OS_GRAPH_COMPRESS_DIRECTED) {
+		ctx.graph->out_ends = malloc(((size_t) ctx.hdr.num_nodes + 1) *
+					     sizeof(*ctx.graph->out_ends));
+		if (ctx.graph->out_ends == NULL) {
+			rc = -ENOMEM;
+			goto out;
+		}
+	}
+
+	parallel_for(tp, ctx.hdr.num_blocks, 1, decode_blocks, &ctx);
+	rc = ctx.error;
+	if (rc == 0)
+		ctx.graph->offsets[ctx.hdr.num_nodes] = 2 * ctx.hdr.num_edges;
+
+out:
+	if (rc < 0) {
+		if (rc == -EINVAL)
+			log_error("Corrupted compressed graph");
+		else
+			log_error("Can't load the compressed graph: %s", strerror(-rc));
+		if (ctx.graph != NULL)
+			destroy_graph(ctx.graph);
+		ctx.graph = NULL;
+	}
+	free(ctx.index);
+
+	return ctx.graph;
+}
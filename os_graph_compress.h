@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_GRAPH_COMPRESS_H__
+#define __OS_GRAPH_COMPRESS_H__	1
+
+#include <stdint.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+/*
+ * Block compressed graph file: a header, an index with one entry per block
+ * of OS_GRAPH_COMPRESS_BLOCK_NODES nodes, then the blocks. A block holds,
+ * for each of its nodes, the degree, the out-degree for directed graphs,
+ * the info value and the neighbours, out-neighbours first, all as LEB128
+ * varints. Signed values are zigzag encoded and neighbours
+ * are stored as deltas from the previous one (from the node itself for the
+ * first one), which keeps sorted and local adjacency lists short.
+ * Blocks are independent, so they are compressed and decompressed in
+ * parallel.
+ */
+#define OS_GRAPH_COMPRESS_MAGIC		0x4b43415047534fULL	/* "OSGPACK" */
+#define OS_GRAPH_COMPRESS_VERSION	2
+#define OS_GRAPH_COMPRESS_BLOCK_NODES	4096
+
+// The graph is directed, its nodes store their out-degree
+#define OS_GRAPH_COMPRESS_DIRECTED	(1U << 0)
+
+typedef struct os_graph_compress_hdr_t {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t block_nodes;
+	uint32_t num_nodes;
+	uint32_t num_edges;
+	uint32_t num_blocks;
+
+	// Size of the largest block, in bytes
+	uint32_t max_block_size;
+	uint32_t flags;
+	uint32_t reserved;
+} os_graph_compress_hdr_t;
+
+typedef struct os_graph_block_t {
+	// Position of the block in the file and its size, in bytes
+	uint64_t offset;
+	uint32_t size;
+
+	// Position of the adjacency of the first node in the neighbours array
+	uint32_t first_edge;
+} os_graph_block_t;
+
+os_graph_t *graph_compress_load(os_threadpool_t *tp, int fd);
+
+#endif
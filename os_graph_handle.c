@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "os_graph_handle.h"
+#include "os_graph_load.h"
+#include "log/log.h"
+#include "utils.h"
+
+typedef struct {
+	os_graph_handle_t *handle;
+	char *path;
+	os_load_opts_t opts;
+} reload_arg_t;
+
+os_graph_handle_t *create_graph_handle(os_graph_t *graph)
+{
+	os_graph_handle_t *handle;
+
+	// Keep the reader slots on separate cache lines
+	if (posix_memalign((void **) &handle, OS_CACHE_LINE, sizeof(*handle)) != 0)
+		return NULL;
+
+	memset(handle->readers, 0, sizeof(handle->readers));
+	handle->current = graph;
+	handle->epoch = 1;
+	handle->retired = NULL;
+	handle->has_retired = false;
+	pthread_mutex_init(&handle->mutex_publish, NULL);
+
+	return handle;
+}
+
+static void destroy_retired(os_graph_retired_t *retired)
+{
+	while (retired != NULL) {
+		os_graph_retired_t *next = retired->next;
+
+		destroy_graph(retired->graph);
+		free(retired);
+		retired = next;
+	}
+}
+
+/*
+ * Destroy a handle, its current graph and the retired ones. No reader may
+ * be registered.
+ */
+void destroy_graph_handle(os_graph_handle_t *handle)
+{
+	pthread_mutex_destroy(&handle->mutex_publish);
+	destroy_retired(handle->retired);
+	if (handle->current != NULL)
+		destroy_graph(handle->current);
+	free(handle);
+}
+
+/* Get a reader slot for the calling thread, NULL if all are taken. */
+os_graph_reader_t *graph_handle_register(os_graph_handle_t *handle)
+{
+	for (unsigned int i = 0; i < OS_GRAPH_MAX_READERS; i++) {
+		os_graph_reader_t *reader = &handle->readers[i];
+		bool expected = false;
+
+		if (__atomic_compare_exchange_n(&reader->in_use, &expected, true, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return reader;
+	}
+
+	log_error("No free graph reader slot");
+
+	return NULL;
+}
+
+void graph_handle_unregister(os_graph_reader_t *reader)
+{
+	__atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&reader->in_use, false, __ATOMIC_RELEASE);
+}
+
+/*
+ * Get the current graph. It stays valid until graph_handle_unpin(), even
+ * if a new version gets published meanwhile. Pins do not nest.
+ */
+os_graph_t *graph_handle_pin(os_graph_handle_t *handle, os_graph_reader_t *reader)
+{
+	unsigned long long epoch = __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST);
+
+	// Announce the epoch before looking at the graph, see graph_handle_publish()
+	__atomic_store_n(&reader->epoch, epoch, __ATOMIC_SEQ_CST);
+
+	return __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Unlink the retired graphs no reader can hold any more: those replaced at
+ * an epoch no later than the oldest epoch announced by a reader. Return
+ * them, to be destroyed without holding the mutex, which must be held.
+ */
+static os_graph_retired_t *reclaim(os_graph_handle_t *handle)
+{
+	unsigned long long oldest = ~0ULL;
+	os_graph_retired_t **prev = &handle->retired, *freed = NULL, *r;
+
+	for (unsigned int i = 0; i < OS_GRAPH_MAX_READERS; i++) {
+		unsigned long long seen = __atomic_load_n(&handle->readers[i].epoch,
+							  __ATOMIC_SEQ_CST);
+
+		if (seen != 0 && seen < oldest)
+			oldest = seen;
+	}
+
+	while ((r = *prev) != NULL) {
+		if (r->epoch <= oldest) {
+			*prev = r->next;
+			r->next = freed;
+			freed = r;
+		} else {
+			prev = &r->next;
+		}
+	}
+
+	__atomic_store_n(&handle->has_retired, handle->retired != NULL, __ATOMIC_RELEASE);
+
+	return freed;
+}
+
+/*
+ * Release the graph pinned by a reader. If replaced graphs are waiting
+ * for readers to leave, try to free them, unless a writer is busy.
+ */
+void graph_handle_unpin(os_graph_handle_t *handle, os_graph_reader_t *reader)
+{
+	os_graph_retired_t *freed;
+
+	__atomic_store_n(&reader->epoch, 0, __ATOMIC_SEQ_CST);
+
+	if (!__atomic_load_n(&handle->has_retired, __ATOMIC_ACQUIRE) ||
+	    pthread_mutex_trylock(&handle->mutex_publish) != 0)
+		return;
+
+	freed = reclaim(handle);
+	DIE(pthread_mutex_unlock(&handle->mutex_publish) != 0, "pthread_mutex_unlock");
+
+	destroy_retired(freed);
+}
+
+/*
+ * Replace the current graph and retire the previous one.
+ * After the swap, the epoch is advanced: a reader announcing the new epoch
+ * is guaranteed to see the new graph, so the previous graph is freed once
+ * no reader announces an older epoch. Return 0, or -ENOMEM, in which case
+ * the current graph is kept.
+ */
+int graph_handle_publish(os_graph_handle_t *handle, os_graph_t *graph)
+{
+	os_graph_retired_t *retired, *freed;
+
+	retired = malloc(sizeof(*retired));
+	if (retired == NULL)
+		return -ENOMEM;
+
+	DIE(pthread_mutex_lock(&handle->mutex_publish) != 0, "pthread_mutex_lock");
+
+	retired->graph = __atomic_exchange_n(&handle->current, graph, __ATOMIC_SEQ_CST);
+	retired->epoch = __atomic_add_fetch(&handle->epoch, 1, __ATOMIC_SEQ_CST);
+	if (retired->graph != NULL) {
+		retired->next = handle->retired;
+		handle->retired = retired;
+	} else {
+		free(retired);
+	}
+	freed = reclaim(handle);
+
+	DIE(pthread_mutex_unlock(&handle->mutex_publish) != 0, "pthread_mutex_unlock");
+
+	destroy_retired(freed);
+
+	return 0;
+}
+
+static void reload_graph(void *arg)
+{
+	reload_arg_t *reload = arg;
+	os_graph_t *graph;
+
+	graph = load_graph(reload->path, &reload->opts);
+	if (graph == NULL) {
+		log_error("Can't load %s, keeping the current graph", reload->path);
+		return;
+	}
+
+	if (graph_handle_publish(reload->handle, graph) < 0) {
+		log_error("Not enough memory to publish %s", reload->path);
+		destroy_graph(graph);
+	}
+}
+
+static void free_reload_arg(void *arg)
+{
+	reload_arg_t *reload = arg;
+
+	free(reload->path);
+	free(reload);
+}
+
+/*
+ * Load a graph file on the threadpool, with the load options opts (the
+ * defaults if NULL) and the parallel stages on tp, and publish it once
+ * built.
+ */
+int graph_handle_reload(os_graph_handle_t *handle, os_threadpool_t *tp,
+		const char *path, const os_load_opts_t *opts)
+{
+	static const os_load_opts_t default_opts = {
+		.default_value = OS_LOAD_DEFAULT_VALUE,
+	};
+	reload_arg_t *reload;
+	os_task_t *t;
+
+	reload = malloc(sizeof(*reload));
+	if (reload == NULL)
+		return -ENOMEM;
+	reload->handle = handle;
+	reload->opts = opts != NULL ? *opts : default_opts;
+	reload->opts.tp = tp;
+	reload->path = strdup(path);
+	if (reload->path == NULL) {
+		free(reload);
+		return -ENOMEM;
+	}
+
+	t = create_task_prio(reload_graph, reload, free_reload_arg, OS_TASK_PRIO_LOW);
+	if (t == NULL) {
+		free_reload_arg(reload);
+		return -ENOMEM;
+	}
+	enqueue_task(tp, t);
+
+	return 0;
+}
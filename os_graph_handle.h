@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_GRAPH_HANDLE_H__
+#define __OS_GRAPH_HANDLE_H__	1
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "os_graph.h"
+#include "os_graph_load.h"
+#include "os_threadpool.h"
+
+#define OS_GRAPH_MAX_READERS	64
+#define OS_CACHE_LINE		64
+
+/*
+ * Reader slot of a graph handle, one cache line each.
+ * epoch is the handle epoch seen when the reader pinned the graph, or 0
+ * while the reader does not hold any version.
+ */
+typedef struct os_graph_reader_t {
+	unsigned long long epoch;
+	bool in_use;
+	char pad[OS_CACHE_LINE - sizeof(unsigned long long) - sizeof(bool)];
+} os_graph_reader_t;
+
+/* Replaced version of a graph, freed once no reader can hold it. */
+typedef struct os_graph_retired_t {
+	struct os_graph_retired_t *next;
+	os_graph_t *graph;
+	// Epoch of the handle once the graph was replaced
+	unsigned long long epoch;
+} os_graph_retired_t;
+
+/*
+ * Handle to the current version of a graph, which can be replaced while
+ * queries are running (RCU style). Readers pin the current version
+ * without taking any lock; a writer swaps the pointer atomically and
+ * retires the previous version, which a later publish or unpin frees
+ * once every reader that could see it has unpinned it. Nobody waits for
+ * the readers.
+ */
+typedef struct os_graph_handle_t {
+	os_graph_reader_t readers[OS_GRAPH_MAX_READERS];
+
+	os_graph_t *current;
+	unsigned long long epoch;
+
+	// Mutex serializing the writers and protecting the retired list
+	pthread_mutex_t mutex_publish;
+	os_graph_retired_t *retired;
+	// Set while retired is not empty, checked by unpin without the mutex
+	bool has_retired;
+} os_graph_handle_t;
+
+os_graph_handle_t *create_graph_handle(os_graph_t *graph);
+void destroy_graph_handle(os_graph_handle_t *handle);
+
+os_graph_reader_t *graph_handle_register(os_graph_handle_t *handle);
+void graph_handle_unregister(os_graph_reader_t *reader);
+
+os_graph_t *graph_handle_pin(os_graph_handle_t *handle, os_graph_reader_t *reader);
+void graph_handle_unpin(os_graph_handle_t *handle, os_graph_reader_t *reader);
+
+int graph_handle_publish(os_graph_handle_t *handle, os_graph_t *graph);
+int graph_handle_reload(os_graph_handle_t *handle, os_threadpool_t *tp,
+		const char *path, const os_load_opts_t *opts);
+
+#endif
@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "os_graph_image.h"
+#include "log/log.h"
+#include "utils.h"
+
+#define IMAGE_ALIGN	64
+
+static uint64_t align_up(uint64_t off)
+{
+	return (off + IMAGE_ALIGN - 1) & ~(uint64_t) (IMAGE_ALIGN - 1);
+}
+
+static void image_layout(os_graph_image_t *hdr, unsigned int num_nodes,
+		unsigned int num_edges, bool directed)
+{
+	uint64_t off;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->version = OS_GRAPH_IMAGE_VERSION;
+	hdr->flags = directed ? OS_GRAPH_IMAGE_DIRECTED : 0;
+	hdr->num_nodes = num_nodes;
+	hdr->num_edges = num_edges;
+
+	off = align_up(sizeof(*hdr));
+	hdr->offsets_off = off;
+	off = align_up(off + ((uint64_t) num_nodes + 1) * sizeof(unsigned int));
+	hdr->neighbours_off = off;
+	off = align_up(off + 2 * (uint64_t) num_edges * sizeof(unsigned int));
+	hdr->info_off = off;
+	off = align_up(off + (uint64_t) num_nodes * sizeof(int));
+	if (directed) {
+		hdr->out_ends_off = off;
+		off = align_up(off + (uint64_t) num_nodes * sizeof(unsigned int));
+	}
+	hdr->size = off;
+}
+
+/* Fill a header describing the layout of the image of a graph. */
+void graph_image_layout(os_graph_t *graph, os_graph_image_t *hdr)
+{
+	image_layout(hdr, graph->num_nodes, graph->num_edges, graph->out_ends != NULL);
+}
+
+size_t graph_image_size(os_graph_t *graph)
+{
+	os_graph_image_t hdr;
+
+	graph_image_layout(graph, &hdr);
+
+	return hdr.size;
+}
+
+/*
+ * Write the image of a graph in a buffer of graph_image_size() bytes.
+ * The magic number is stored last, with release semantics, so a reader
+ * seeing it also sees the whole image.
+ */
+void graph_image_write(os_graph_t *graph, void *image)
+{
+	os_graph_image_t *hdr = image;
+	char *base = image;
+
+	graph_image_layout(graph, hdr);
+
+	memcpy(base + hdr->offsets_off, graph->offsets,
+		((size_t) graph->num_nodes + 1) * sizeof(*graph->offsets));
+	memcpy(base + hdr->neighbours_off, graph->neighbours,
+		2 * (size_t) graph->num_edges * sizeof(*graph->neighbours));
+	memcpy(base + hdr->info_off, graph->info,
+		(size_t) graph->num_nodes * sizeof(*graph->info));
+	if (graph->out_ends != NULL)
+		memcpy(base + hdr->out_ends_off, graph->out_ends,
+			(size_t) graph->num_nodes * sizeof(*graph->out_ends));
+
+	__atomic_store_n(&hdr->magic, OS_GRAPH_IMAGE_MAGIC, __ATOMIC_RELEASE);
+}
+
+/*
+ * Check that the arrays of a mapped graph describe a valid adjacency, so
+ * that a corrupted image can't make the engines index out of bounds.
+ */
+static int check_arrays(os_graph_t *graph)
+{
+	unsigned int bad = 0;
+
+	if (graph->offsets[0] != 0 ||
+	    graph->offsets[graph->num_nodes] != 2 * graph->num_edges)
+		return -1;
+	for (unsigned int i = 0; i < graph->num_nodes; i++)
+		bad |= graph->offsets[i] > graph->offsets[i + 1];
+	for (unsigned int i = 0; graph->out_ends != NULL && i < graph->num_nodes; i++)
+		bad |= graph->out_ends[i] < graph->offsets[i] ||
+			graph->out_ends[i] > graph->offsets[i + 1];
+	for (size_t i = 0; i < 2 * (size_t) graph->num_edges; i++)
+		bad |= graph->neighbours[i] >= graph->num_nodes;
+
+	return bad ? -1 : 0;
+}
+
+/*
+ * Create a graph whose arrays live in a mapped image.
+ * The graph takes ownership of the mapping, which is unmapped by
+ * destroy_graph(). Return NULL if the image is not valid. The header is
+ * always checked; with check set, so is the whole adjacency, which costs
+ * a pass over it and is meant for images read from files.
+ */
+os_graph_t *graph_image_map(void *image, size_t size, bool check)
+{
+	os_graph_image_t *hdr = image;
+	os_graph_image_t expected;
+	os_graph_t *graph;
+	char *base = image;
+
+	if (size < sizeof(*hdr) ||
+	    __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != OS_GRAPH_IMAGE_MAGIC) {
+		log_error("Not a graph image");
+		return NULL;
+	}
+
+	if (hdr->version != OS_GRAPH_IMAGE_VERSION) {
+		log_error("Unsupported graph image version %u", hdr->version);
+		return NULL;
+	}
+
+	// The layout is fully determined by the sizes, check it matches
+	image_layout(&expected, hdr->num_nodes, hdr->num_edges,
+		     hdr->flags & OS_GRAPH_IMAGE_DIRECTED);
+	if (hdr->num_edges > UINT32_MAX / 2 || hdr->flags != expected.flags ||
+	    hdr->size != expected.size || hdr->size > size ||
+	    hdr->offsets_off != expected.offsets_off ||
+	    hdr->neighbours_off != expected.neighbours_off ||
+	    hdr->info_off != expected.info_off ||
+	    hdr->out_ends_off != expected.out_ends_off) {
+		log_error("Corrupted graph image");
+		return NULL;
+	}
+
+	graph = calloc(1, sizeof(*graph));
+	if (graph == NULL) {
+		log_error("Not enough memory");
+		return NULL;
+	}
+	graph->num_nodes = hdr->num_nodes;
+	graph->num_edges = hdr->num_edges;
+	graph->offsets = (unsigned int *) (base + hdr->offsets_off);
+	graph->neighbours = (unsigned int *) (base + hdr->neighbours_off);
+	graph->info = (int *) (base + hdr->info_off);
+	if (hdr->out_ends_off != 0)
+		graph->out_ends = (unsigned int *) (base + hdr->out_ends_off);
+	if (check && check_arrays(graph) < 0) {
+		log_error("Corrupted graph image");
+		free(graph);
+		return NULL;
+	}
+	graph->mapping = image;
+	graph->mapping_size = size;
+
+	return graph;
+}
+
+/*
+ * Publish a graph in a named POSIX shared memory segment.
+ * An existing segment with the same name is replaced; processes already
+ * attached to it keep their mapping.
+ */
+int graph_publish_shm(os_graph_t *graph, const char *name)
+{
+	size_t size = graph_image_size(graph);
+	void *image;
+	int fd;
+
+	shm_unlink(name);
+
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		log_error("Can't create shared memory segment %s", name);
+		return -1;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		log_error("Can't resize shared memory segment %s", name);
+		goto err_unlink;
+	}
+
+	image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (image == MAP_FAILED) {
+		log_error("Can't map shared memory segment %s", name);
+		goto err_unlink;
+	}
+
+	graph_image_write(graph, image);
+
+	munmap(image, size);
+	close(fd);
+
+	return 0;
+
+err_unlink:
+	shm_unlink(name);
+	close(fd);
+	return -1;
+}
+
+/* Map a graph published by graph_publish_shm(), read-only. */
+os_graph_t *graph_attach_shm(const char *name)
+{
+	os_graph_t *graph;
+	struct stat st;
+	void *image;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		log_error("Can't open shared memory segment %s", name);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		log_error("Can't stat shared memory segment %s", name);
+		close(fd);
+		return NULL;
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		log_error("Can't map shared memory segment %s", name);
+		return NULL;
+	}
+
+	// The publisher wrote the segment and its magic last, trust the arrays
+	graph = graph_image_map(image, st.st_size, false);
+	if (graph == NULL)
+		munmap(image, st.st_size);
+
+	return graph;
+}
+
+int graph_unlink_shm(const char *name)
+{
+	return shm_unlink(name);
+}
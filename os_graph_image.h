@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_GRAPH_IMAGE_H__
+#define __OS_GRAPH_IMAGE_H__	1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "os_graph.h"
+
+/*
+ * Flat, position independent image of a graph: a header followed by the
+ * offsets, neighbours and info arrays, then the out_ends array of directed
+ * graphs, each aligned to a cache line.
+ * The image is what gets placed in shared memory, so any process can map
+ * it and use the arrays in place.
+ */
+#define OS_GRAPH_IMAGE_MAGIC	0x4850415247534fULL	/* "OSGRAPH" */
+#define OS_GRAPH_IMAGE_VERSION	2
+
+// The image holds a directed graph, with an out_ends array
+#define OS_GRAPH_IMAGE_DIRECTED	(1U << 0)
+
+typedef struct os_graph_image_t {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t num_nodes;
+	uint32_t num_edges;
+
+	// Byte offsets of the arrays, from the start of the image
+	uint64_t offsets_off;
+	uint64_t neighbours_off;
+	uint64_t info_off;
+	// 0 if the graph is undirected
+	uint64_t out_ends_off;
+
+	// Total size of the image, in bytes
+	uint64_t size;
+} os_graph_image_t;
+
+void graph_image_layout(os_graph_t *graph, os_graph_image_t *hdr);
+size_t graph_image_size(os_graph_t *graph);
+void graph_image_write(os_graph_t *graph, void *image);
+os_graph_t *graph_image_map(void *image, size_t size, bool check);
+
+int graph_publish_shm(os_graph_t *graph, const char *name);
+os_graph_t *graph_attach_shm(const char *name);
+int graph_unlink_shm(const char *name);
+
+#endif
@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "os_graph_load.h"
+#include "os_graph_cache.h"
+#include "os_graph_compress.h"
+#include "os_graph_image.h"
+#include "os_graph_stream.h"
+#include "log/log.h"
+
+// Bytes read from an input which can't be mapped before growing its buffer
+#define READ_INITIAL_SIZE	(1UL << 20)
+// Bytes needed to tell the text formats apart, see graph_detect_format()
+#define SNIFF_SIZE		14
+
+/*
+ * Read the start of a file which can't be mapped, such as a pipe, into a
+ * buffer of cap bytes: at least enough to detect its format, unless the
+ * file ends first. Return the number of bytes read, or -1.
+ */
+static ssize_t read_start(int fd, char *buf, size_t cap)
+{
+	size_t len = 0;
+	bool blank = true;
+	ssize_t n;
+
+	while (len < SNIFF_SIZE || blank) {
+		n = read(fd, buf + len, cap - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		for (ssize_t i = 0; i < n && blank; i++)
+			blank = isspace((unsigned char) buf[len + i]);
+		len += n;
+		if (len == cap)
+			break;
+	}
+
+	return len;
+}
+
+/*
+ * Read the rest of a file which can't be mapped, after the len bytes
+ * already in data, a malloc'ed buffer of cap bytes.
+ */
+static char *read_file(int fd, char *data, size_t len, size_t cap, size_t *size)
+{
+	char *tmp;
+	ssize_t n;
+
+	while (data != NULL) {
+		if (len == cap) {
+			cap *= 2;
+			tmp = realloc(data, cap);
+			if (tmp == NULL)
+				break;
+			data = tmp;
+		}
+
+		n = read(fd, data + len, cap - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n == 0) {
+			*size = len;
+			return data;
+		}
+		if (n < 0)
+			break;
+		len += n;
+	}
+
+	free(data);
+	return NULL;
+}
+
+static os_graph_t *parse_graph_text(const char *data, size_t size, bool mapped,
+		const os_load_opts_t *opts)
+{
+	os_graph_format_t format = opts->format;
+
+	if (format == OS_GRAPH_FORMAT_AUTO)
+		format = graph_detect_format(data, size);
+	if (format == OS_GRAPH_FORMAT_NATIVE)
+		return create_graph_from_text(data, size, mapped, opts->directed);
+
+	return create_graph_from_edge_list(opts->tp, data, size, format,
+					   opts->default_value, opts->directed);
+}
+
+/*
+ * Parse a text graph file, "-" being the standard input. Regular files are
+ * mapped and parsed in place. Undirected SNAP edge lists from other files,
+ * such as pipes, are streamed, whether given as such or detected from
+ * their start; other inputs are read in memory first.
+ */
+static os_graph_t *parse_graph_file(const char *path, const os_load_opts_t *opts)
+{
+	os_graph_format_t format = opts->format;
+	os_graph_t *graph;
+	struct stat st;
+	size_t size;
+	ssize_t len;
+	char *data;
+	int fd;
+
+	if (strcmp(path, "-") == 0)
+		fd = dup(STDIN_FILENO);
+	else
+		fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		log_error("Can't open %s", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		log_error("Can't stat %s", path);
+		close(fd);
+		return NULL;
+	}
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			close(fd);
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			graph = parse_graph_text(data, st.st_size, true, opts);
+			munmap(data, st.st_size);
+			return graph;
+		}
+	}
+
+	data = malloc(READ_INITIAL_SIZE);
+	len = data != NULL ? read_start(fd, data, READ_INITIAL_SIZE) : -1;
+	if (len < 0) {
+		log_error("Can't read %s", path);
+		free(data);
+		close(fd);
+		return NULL;
+	}
+
+	// The bytes sniffed are handed over to the stream
+	if (format == OS_GRAPH_FORMAT_AUTO)
+		format = graph_detect_format(data, len);
+	if (!S_ISREG(st.st_mode) && format == OS_GRAPH_FORMAT_SNAP &&
+	    !opts->directed) {
+		graph = create_graph_from_stream(opts->tp, fd, data, len,
+						 opts->default_value);
+		free(data);
+		close(fd);
+		return graph;
+	}
+
+	data = read_file(fd, data, len, READ_INITIAL_SIZE, &size);
+	close(fd);
+	if (data == NULL) {
+		log_error("Can't read %s", path);
+		return NULL;
+	}
+
+	graph = parse_graph_text(data, size, false, opts);
+	free(data);
+
+	return graph;
+}
+
+static os_graph_t *map_graph_image(int fd)
+{
+	os_graph_t *graph;
+	struct stat st;
+	void *image;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (image == MAP_FAILED)
+		return NULL;
+
+	graph = graph_image_map(image, st.st_size, true);
+	if (graph == NULL)
+		munmap(image, st.st_size);
+
+	return graph;
+}
+
+/*
+ * Load a binary graph file, recognized by its magic number. Return 1 and
+ * set *graph if the file is binary, 0 if it should be parsed as text.
+ */
+static int load_binary(const char *path, os_threadpool_t *tp, os_graph_t **graph)
+{
+	uint64_t magic;
+	int fd, binary = 1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	if (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+		binary = 0;
+	else if (magic == OS_GRAPH_COMPRESS_MAGIC)
+		*graph = graph_compress_load(tp, fd);
+	else if (magic == OS_GRAPH_IMAGE_MAGIC)
+		*graph = map_graph_image(fd);
+	else
+		binary = 0;
+
+	close(fd);
+
+	return binary;
+}
+
+/*
+ * Load a graph file, "-" for the standard input: a graph image or a block
+ * compressed graph, recognized by their magic numbers, or else a text graph
+ * in the format given by the options, recognized from its start by
+ * default. Binary graphs are directed if they were written from a directed
+ * graph, text graphs if the options ask for it. Large text inputs are
+ * cached: a valid binary cache is mapped instead of parsing the input, and
+ * a missing or stale one is rewritten after parsing. Failing to write the
+ * cache is not an error.
+ */
+os_graph_t *load_graph(const char *path, const os_load_opts_t *opts)
+{
+	static const os_load_opts_t default_opts = {
+		.default_value = OS_LOAD_DEFAULT_VALUE,
+	};
+	os_graph_cache_key_t key;
+	os_graph_t *graph = NULL;
+	bool regular, cache;
+	struct stat st;
+	int rc;
+
+	if (opts == NULL)
+		opts = &default_opts;
+
+	// Only regular files can be sniffed or cached without consuming them
+	regular = strcmp(path, "-") != 0 && stat(path, &st) == 0 &&
+		S_ISREG(st.st_mode);
+	if (regular && load_binary(path, opts->tp, &graph)) {
+		if (graph != NULL && opts->directed && graph->out_ends == NULL) {
+			log_error("%s is an undirected binary graph", path);
+			destroy_graph(graph);
+			return NULL;
+		}
+		return graph;
+	}
+
+	// Caches are keyed by the text format only, not the direction
+	cache = regular && !opts->no_cache && !opts->directed &&
+		graph_cache_key(path, &key) == 0 && key.size >= OS_GRAPH_CACHE_MIN_SIZE;
+	if (cache) {
+		key.format = opts->format;
+		key.default_value = opts->default_value;
+		graph = graph_cache_open(path, &key);
+		if (graph != NULL)
+			return graph;
+	}
+
+	graph = parse_graph_file(path, opts);
+	if (graph == NULL)
+		return NULL;
+
+	if (cache) {
+		rc = graph_cache_store(graph, path, &key);
+		if (rc < 0)
+			log_debug("Can't write the cache of %s: %s", path, strerror(-rc));
+	}
+
+	return graph;
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_GRAPH_LOAD_H__
+#define __OS_GRAPH_LOAD_H__	1
+
+#include <stdbool.h>
+
+#include "os_graph.h"
+#include "os_graph_parse.h"
+#include "os_threadpool.h"
+
+// Value of the nodes of formats without node values
+#define OS_LOAD_DEFAULT_VALUE	1
+
+/* Optional settings of the loader; a NULL pointer selects the defaults. */
+typedef struct os_load_opts_t {
+	// Pool used by the parallel loading stages, NULL to load serially
+	os_threadpool_t *tp;
+
+	// Neither look for nor write a binary cache next to the input
+	bool no_cache;
+
+	// Text format of the input, and value given to nodes without one
+	os_graph_format_t format;
+	int default_value;
+
+	// Keep the direction of the edges of a text input, which is not cached
+	bool directed;
+} os_load_opts_t;
+
+os_graph_t *load_graph(const char *path, const os_load_opts_t *opts);
+
+#endif
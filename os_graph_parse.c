@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "os_graph_parse.h"
+#include "log/log.h"
+
+// Edge list text is split in chunks of about this size, parsed in parallel
+#define PARSE_CHUNK_SIZE	(1UL << 20)
+// Edges remapped by each task of the id compaction
+#define COMPACT_GRAIN		(64 * 1024)
+
+typedef struct {
+	// Whole lines of the chunk
+	const char *begin, *end;
+	unsigned long long num_edges;
+	unsigned long long first_edge;
+	unsigned int max_id;
+} parse_chunk_t;
+
+typedef struct {
+	os_graph_format_t format;
+	unsigned int rows, cols;
+	unsigned int num_chunks;
+	parse_chunk_t *chunks;
+	os_edge_t *edges;
+	unsigned int num_edges;
+
+	// Id compaction: dense rank of each id, or sorted distinct ids
+	unsigned int *rank;
+	unsigned int *ids;
+	unsigned int num_ids;
+	int error;
+} parse_ctx_t;
+
+/* Parse an unsigned decimal number, skipping the whitespace before it. */
+const char *parse_uint(const char *p, const char *end, unsigned int *v)
+{
+	unsigned long long value = 0;
+
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+	if (p == end || !isdigit((unsigned char) *p))
+		return NULL;
+
+	while (p < end && isdigit((unsigned char) *p)) {
+		value = value * 10 + (*p++ - '0');
+		if (value > UINT_MAX)
+			return NULL;
+	}
+
+	*v = value;
+	return p;
+}
+
+const char *parse_int(const char *p, const char *end, int *v)
+{
+	unsigned int value;
+	int negative = 0;
+
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	p = parse_uint(p, end, &value);
+	if (p == NULL || value > (unsigned int) INT_MAX + negative)
+		return NULL;
+
+	*v = negative ? (int) -(long long) value : (int) value;
+	return p;
+}
+
+
+static const char *line_end(const char *p, const char *end)
+{
+	const char *eol = memchr(p, '\n', end - p);
+
+	return eol != NULL ? eol : end;
+}
+
+/* Return the first character of a line, if it holds data. */
+static const char *line_data(const char *p, const char *eol)
+{
+	while (p < eol && isspace((unsigned char) *p))
+		p++;
+	if (p == eol || *p == '#' || *p == '%')
+		return NULL;
+
+	return p;
+}
+
+os_graph_format_t graph_detect_format(const char *data, size_t size)
+{
+	const char *p = data, *end = data + size;
+
+	if (size >= 14 && strncasecmp(data, "%%MatrixMarket", 14) == 0)
+		return OS_GRAPH_FORMAT_MTX;
+
+	// SNAP files start with comments, native ones with their sizes
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+	if (p < end && *p == '#')
+		return OS_GRAPH_FORMAT_SNAP;
+
+	return OS_GRAPH_FORMAT_NATIVE;
+}
+
+int graph_format_from_name(const char *name)
+{
+	if (strcmp(name, "auto") == 0)
+		return OS_GRAPH_FORMAT_AUTO;
+	if (strcmp(name, "native") == 0)
+		return OS_GRAPH_FORMAT_NATIVE;
+	if (strcmp(name, "snap") == 0)
+		return OS_GRAPH_FORMAT_SNAP;
+	if (strcmp(name, "mtx") == 0)
+		return OS_GRAPH_FORMAT_MTX;
+
+	return -EINVAL;
+}
+
+/*
+ * Parse the banner and the size line of a Matrix Market file, return the
+ * start of the entries or NULL.
+ */
+static const char *parse_mtx_header(parse_ctx_t *ctx, const char *data,
+		const char *end, unsigned int *nnz)
+{
+	const char *p = data, *eol = line_end(data, end);
+	char banner[128];
+	size_t len = eol - p;
+
+	if (len >= sizeof(banner))
+		len = sizeof(banner) - 1;
+	memcpy(banner, p, len);
+	banner[len] = '\0';
+	for (size_t i = 0; i < len; i++)
+		banner[i] = tolower((unsigned char) banner[i]);
+	if (strstr(banner, "matrix") == NULL || strstr(banner, "coordinate") == NULL) {
+		log_error("Only Matrix Market coordinate matrices are supported");
+		return NULL;
+	}
+
+	// The size line is the first one after the comments
+	for (p = eol; p < end; p = eol) {
+		const char *q;
+
+		p++;
+		eol = line_end(p, end);
+		q = line_data(p, eol);
+		if (q == NULL)
+			continue;
+
+		q = parse_uint(q, eol, &ctx->rows);
+		if (q != NULL)
+			q = parse_uint(q, eol, &ctx->cols);
+		if (q != NULL)
+			q = parse_uint(q, eol, nnz);
+		if (q == NULL)
+			break;
+
+		return eol < end ? eol + 1 : end;
+	}
+
+	log_error("Can't read the Matrix Market size line");
+	return NULL;
+}
+
+/* Count the data lines of chunks [begin, end). */
+static void count_edges(void *arg, unsigned int begin, unsigned int end)
+{
+	parse_ctx_t *ctx = arg;
+
+	for (unsigned int c = begin; c < end; c++) {
+		parse_chunk_t *chunk = &ctx->chunks[c];
+		unsigned long long count = 0;
+
+		for (const char *p = chunk->begin, *eol; p < chunk->end; p = eol + 1) {
+			eol = line_end(p, chunk->end);
+			if (line_data(p, eol) != NULL)
+				count++;
+		}
+		chunk->num_edges = count;
+	}
+}
+
+/* Parse the edges of chunks [begin, end) at their place in the edge array. */
+static void parse_edges(void *arg, unsigned int begin, unsigned int end)
+{
+	parse_ctx_t *ctx = arg;
+
+	for (unsigned int c = begin; c < end; c++) {
+		parse_chunk_t *chunk = &ctx->chunks[c];
+		os_edge_t *edge = ctx->edges + chunk->first_edge;
+		unsigned int max_id = 0;
+
+		for (const char *p = chunk->begin, *eol; p < chunk->end; p = eol + 1) {
+			const char *q;
+
+			eol = line_end(p, chunk->end);
+			q = line_data(p, eol);
+			if (q == NULL)
+				continue;
+
+			q = parse_uint(q, eol, &edge->src);
+			if (q != NULL)
+				q = parse_uint(q, eol, &edge->dst);
+			if (q == NULL) {
+				__atomic_store_n(&ctx->error, -EINVAL, __ATOMIC_RELAXED);
+				return;
+			}
+
+			if (ctx->format == OS_GRAPH_FORMAT_MTX) {
+				if (edge->src == 0 || edge->src > ctx->rows ||
+				    edge->dst == 0 || edge->dst > ctx->cols) {
+					__atomic_store_n(&ctx->error, -ERANGE, __ATOMIC_RELAXED);
+					return;
+				}
+				edge->src--;
+				edge->dst--;
+			}
+
+			if (edge->src > max_id)
+				max_id = edge->src;
+			if (edge->dst > max_id)
+				max_id = edge->dst;
+			edge++;
+		}
+		chunk->max_id = max_id;
+	}
+}
+
+/* Split the text in chunks of whole lines. */
+static int split_chunks(parse_ctx_t *ctx, const char *data, const char *end)
+{
+	const char *prev = data;
+
+	ctx->num_chunks = (end - data) / PARSE_CHUNK_SIZE + 1;
+	ctx->chunks = calloc(ctx->num_chunks, sizeof(*ctx->chunks));
+	if (ctx->chunks == NULL)
+		return -ENOMEM;
+
+	for (unsigned int c = 0; c < ctx->num_chunks; c++) {
+		const char *p = data + (size_t) c * PARSE_CHUNK_SIZE;
+
+		// A chunk starts at the first line starting in its range
+		if (p > end)
+			p = end;
+		if (p > data && p < end && p[-1] != '\n') {
+			p = memchr(p, '\n', end - p);
+			p = p != NULL ? p + 1 : end;
+		}
+		if (p < prev)
+			p = prev;
+
+		ctx->chunks[c].begin = p;
+		if (c > 0)
+			ctx->chunks[c - 1].end = p;
+		prev = p;
+	}
+	ctx->chunks[ctx->num_chunks - 1].end = end;
+
+	return 0;
+}
+
+static void mark_ids(void *arg, unsigned int begin, unsigned int end)
+{
+	parse_ctx_t *ctx = arg;
+
+	for (unsigned int i = begin; i < end; i++) {
+		__atomic_store_n(&ctx->rank[ctx->edges[i].src], 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&ctx->rank[ctx->edges[i].dst], 1, __ATOMIC_RELAXED);
+	}
+}
+
+static unsigned int sparse_rank(parse_ctx_t *ctx, unsigned int id)
+{
+	unsigned int lo = 0, hi = ctx->num_ids;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (ctx->ids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void remap_ids(void *arg, unsigned int begin, unsigned int end)
+{
+	parse_ctx_t *ctx = arg;
+
+	for (unsigned int i = begin; i < end; i++) {
+		os_edge_t *edge = &ctx->edges[i];
+
+		if (ctx->rank != NULL) {
+			edge->src = ctx->rank[edge->src];
+			edge->dst = ctx->rank[edge->dst];
+		} else {
+			edge->src = sparse_rank(ctx, edge->src);
+			edge->dst = sparse_rank(ctx, edge->dst);
+		}
+	}
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Renumber the ids used by the edges as 0 to num_ids - 1, keeping their
+ * order. Small id spaces are ranked with a dense array, others by binary
+ * search in the sorted distinct ids.
+ */
+static int compact_ids(os_threadpool_t *tp, parse_ctx_t *ctx, unsigned int max_id)
+{
+	unsigned int n = 0;
+
+	if (ctx->num_edges == 0)
+		return 0;
+
+	if (max_id / 4 <= ctx->num_edges) {
+		ctx->rank = calloc((size_t) max_id + 1, sizeof(*ctx->rank));
+		if (ctx->rank == NULL)
+			return -ENOMEM;
+
+		parallel_for(tp, ctx->num_edges, COMPACT_GRAIN, mark_ids, ctx);
+		for (size_t id = 0; id <= max_id; id++) {
+			if (ctx->rank[id])
+				ctx->rank[id] = n++;
+		}
+	} else {
+		ctx->ids = malloc(2 * (size_t) ctx->num_edges * sizeof(*ctx->ids));
+		if (ctx->ids == NULL)
+			return -ENOMEM;
+
+		for (unsigned int i = 0; i < ctx->num_edges; i++) {
+			ctx->ids[2 * i] = ctx->edges[i].src;
+			ctx->ids[2 * i + 1] = ctx->edges[i].dst;
+		}
+		qsort(ctx->ids, 2 * (size_t) ctx->num_edges, sizeof(*ctx->ids), compare_ids);
+		for (size_t i = 0; i < 2 * (size_t) ctx->num_edges; i++) {
+			if (n == 0 || ctx->ids[i] != ctx->ids[n - 1])
+				ctx->ids[n++] = ctx->ids[i];
+		}
+	}
+	ctx->num_ids = n;
+
+	parallel_for(tp, ctx->num_edges, COMPACT_GRAIN, remap_ids, ctx);
+
+	return 0;
+}
+
+/*
+ * Build a graph from a SNAP edge list or a Matrix Market file held in
+ * memory. The text is split in chunks of whole lines, which are parsed in
+ * parallel on tp (serially if tp is NULL): a first pass counts the edges
+ * of each chunk, giving its place in the edge array, and a second one
+ * parses them there. SNAP ids are compacted, so sparse id spaces don't
+ * create isolated nodes; Matrix Market ids index a matrix of at most
+ * max(rows, cols) nodes. These formats have no node values, every node
+ * gets default_value. If directed is set, the graph keeps the direction of
+ * the edges, from the first id of each line to the second.
+ */
+os_graph_t *create_graph_from_edge_list(os_threadpool_t *tp, const char *data,
+		size_t size, os_graph_format_t format, int default_value, bool directed)
+{
+	const char *body = data, *end = data + size;
+	unsigned long long num_edges = 0;
+	unsigned int nnz = 0, max_id = 0, num_nodes;
+	os_graph_t *graph = NULL;
+	parse_ctx_t ctx;
+	int *values = NULL;
+	int rc;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.format = format;
+
+	if (format == OS_GRAPH_FORMAT_MTX) {
+		body = parse_mtx_header(&ctx, data, end, &nnz);
+		if (body == NULL)
+			return NULL;
+	}
+
+	rc = split_chunks(&ctx, body, end);
+	if (rc < 0)
+		goto out;
+
+	parallel_for(tp, ctx.num_chunks, 1, count_edges, &ctx);
+	for (unsigned int c = 0; c < ctx.num_chunks; c++) {
+		ctx.chunks[c].first_edge = num_edges;
+		num_edges += ctx.chunks[c].num_edges;
+	}
+
+	// Both directions of every edge are indexed by unsigned int offsets
+	if (num_edges > UINT_MAX / 2 ||
+	    (format == OS_GRAPH_FORMAT_MTX && num_edges != nnz)) {
+		rc = -EINVAL;
+		goto out;
+	}
+	ctx.num_edges = num_edges;
+
+	ctx.edges = malloc((num_edges + 1) * sizeof(*ctx.edges));
+	if (ctx.edges == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	parallel_for(tp, ctx.num_chunks, 1, parse_edges, &ctx);
+	rc = ctx.error;
+	if (rc < 0)
+		goto out;
+
+	if (format == OS_GRAPH_FORMAT_MTX) {
+		num_nodes = ctx.rows > ctx.cols ? ctx.rows : ctx.cols;
+	} else {
+		for (unsigned int c = 0; c < ctx.num_chunks; c++) {
+			if (ctx.chunks[c].max_id > max_id)
+				max_id = ctx.chunks[c].max_id;
+		}
+		rc = compact_ids(tp, &ctx, max_id);
+		if (rc < 0)
+			goto out;
+		num_nodes = ctx.num_ids;
+	}
+
+	values = malloc(((size_t) num_nodes + 1) * sizeof(*values));
+	if (values == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	for (unsigned int i = 0; i < num_nodes; i++)
+		values[i] = default_value;
+
+	if (directed)
+		graph = create_digraph_from_data(num_nodes, ctx.num_edges, values, ctx.edges);
+	else
+		graph = create_graph_from_data(num_nodes, ctx.num_edges, values, ctx.edges);
+	if (graph == NULL)
+		rc = -ENOMEM;
+
+out:
+	if (rc == -EINVAL)
+		log_error("Invalid edge list");
+	else if (rc == -ERANGE)
+		log_error("Matrix Market entry out of range");
+	else if (rc < 0)
+		log_error("Can't load the edge list: %s", strerror(-rc));
+
+	free(values);
+	free(ctx.rank);
+	free(ctx.ids);
+	free(ctx.edges);
+	free(ctx.chunks);
+
+	return graph;
+}
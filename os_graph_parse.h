@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_GRAPH_PARSE_H__
+#define __OS_GRAPH_PARSE_H__	1
+
+#include <stddef.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+typedef enum {
+	OS_GRAPH_FORMAT_AUTO,	// recognized from the start of the text
+	OS_GRAPH_FORMAT_NATIVE,	// "num_nodes num_edges", node values, edges
+	OS_GRAPH_FORMAT_SNAP,	// "src dst" lines with '#' comments, any ids
+	OS_GRAPH_FORMAT_MTX,	// Matrix Market coordinate file, 1-based ids
+} os_graph_format_t;
+
+const char *parse_uint(const char *p, const char *end, unsigned int *v);
+const char *parse_int(const char *p, const char *end, int *v);
+
+os_graph_format_t graph_detect_format(const char *data, size_t size);
+int graph_format_from_name(const char *name);
+os_graph_t *create_graph_from_edge_list(os_threadpool_t *tp, const char *data,
+		size_t size, os_graph_format_t format, int default_value, bool directed);
+
+#endif
@@ -0,0 +1,510 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "os_graph_stream.h"
+#include "os_graph_parse.h"
+#include "log/log.h"
+
+#define STREAM_BUFFER_SIZE	(1UL << 20)
+#define STREAM_NUM_BUFFERS	4
+#define STREAM_ARENA_SIZE	(1UL << 20)
+#define STREAM_MIN_BLOCK	4
+#define STREAM_MAX_BLOCK	256
+#define STREAM_COPY_GRAIN	4096
+
+/*
+ * Adjacency of a vertex while the stream is read: a chain of blocks, each
+ * twice as large as the previous one up to STREAM_MAX_BLOCK entries,
+ * carved out of large arena chunks. Entries are vertex slots, in order of
+ * first appearance; they become node ids when the stream ends.
+ */
+typedef struct stream_block_t {
+	struct stream_block_t *next;
+	unsigned int count, cap;
+	unsigned int data[];
+} stream_block_t;
+
+typedef struct {
+	unsigned int id;
+	unsigned int degree;
+	stream_block_t *head, *tail;
+} stream_vertex_t;
+
+typedef struct stream_arena_t {
+	struct stream_arena_t *next;
+	size_t used;
+	char data[];
+} stream_arena_t;
+
+typedef struct {
+	int fd;
+
+	// Ring of buffers filled by the reader thread, in order
+	char *bufs[STREAM_NUM_BUFFERS];
+	size_t lens[STREAM_NUM_BUFFERS];
+	unsigned int num_filled, num_consumed;
+	int eof;
+	int error;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} stream_reader_t;
+
+typedef struct {
+	stream_vertex_t *vertices;
+	unsigned int num_vertices, max_vertices;
+	unsigned long long num_edges;
+
+	// Open addressing table from ids to vertex slots, slot + 1 or 0 if free
+	unsigned int *table_ids;
+	unsigned int *table_slots;
+	unsigned int table_bits;
+
+	stream_arena_t *arena;
+
+	// Incomplete line at the end of the last buffer
+	char *carry;
+	size_t carry_len, carry_cap;
+
+	// Final numbering: node of each slot, and slot of each node
+	unsigned int *rank, *order;
+	os_graph_t *graph;
+} stream_builder_t;
+
+static void *reader_thread(void *arg)
+{
+	stream_reader_t *reader = arg;
+	int eof = 0, error = 0;
+
+	while (!eof && !error) {
+		unsigned int idx;
+		ssize_t n;
+
+		pthread_mutex_lock(&reader->mutex);
+		while (reader->num_filled - reader->num_consumed == STREAM_NUM_BUFFERS &&
+		       !reader->error)
+			pthread_cond_wait(&reader->cond, &reader->mutex);
+		error = reader->error;
+		idx = reader->num_filled % STREAM_NUM_BUFFERS;
+		pthread_mutex_unlock(&reader->mutex);
+		if (error)
+			break;
+
+		// The buffer is not used by the parser until it is published
+		do {
+			n = read(reader->fd, reader->bufs[idx], STREAM_BUFFER_SIZE);
+		} while (n < 0 && errno == EINTR);
+
+		pthread_mutex_lock(&reader->mutex);
+		if (n < 0) {
+			reader->error = error = -errno;
+		} else if (n == 0) {
+			reader->eof = eof = 1;
+		} else {
+			reader->lens[idx] = n;
+			reader->num_filled++;
+		}
+		pthread_cond_broadcast(&reader->cond);
+		pthread_mutex_unlock(&reader->mutex);
+	}
+
+	return NULL;
+}
+
+/* Wait for the next filled buffer, return its index or -1 at the end. */
+static int reader_next(stream_reader_t *reader)
+{
+	int idx = -1;
+
+	pthread_mutex_lock(&reader->mutex);
+	while (reader->num_filled == reader->num_consumed && !reader->eof &&
+	       !reader->error)
+		pthread_cond_wait(&reader->cond, &reader->mutex);
+	if (reader->num_filled != reader->num_consumed && !reader->error)
+		idx = reader->num_consumed % STREAM_NUM_BUFFERS;
+	pthread_mutex_unlock(&reader->mutex);
+
+	return idx;
+}
+
+static void reader_release(stream_reader_t *reader)
+{
+	pthread_mutex_lock(&reader->mutex);
+	reader->num_consumed++;
+	pthread_cond_broadcast(&reader->cond);
+	pthread_mutex_unlock(&reader->mutex);
+}
+
+static void reader_stop(stream_reader_t *reader, int error)
+{
+	pthread_mutex_lock(&reader->mutex);
+	if (reader->error == 0)
+		reader->error = error;
+	pthread_cond_broadcast(&reader->cond);
+	pthread_mutex_unlock(&reader->mutex);
+}
+
+static void *arena_alloc(stream_builder_t *b, size_t size)
+{
+	stream_arena_t *arena = b->arena;
+
+	size = (size + 7) & ~(size_t) 7;
+	if (arena == NULL || arena->used + size > STREAM_ARENA_SIZE) {
+		arena = malloc(sizeof(*arena) + STREAM_ARENA_SIZE);
+		if (arena == NULL)
+			return NULL;
+		arena->next = b->arena;
+		arena->used = 0;
+		b->arena = arena;
+	}
+
+	arena->used += size;
+	return arena->data + arena->used - size;
+}
+
+static int table_grow(stream_builder_t *b)
+{
+	unsigned int bits = b->table_bits ? b->table_bits + 1 : 16;
+	size_t size = (size_t) 1 << bits, mask = size - 1;
+	unsigned int *ids, *slots;
+
+	ids = malloc(size * sizeof(*ids));
+	slots = calloc(size, sizeof(*slots));
+	if (ids == NULL || slots == NULL) {
+		free(ids);
+		free(slots);
+		return -ENOMEM;
+	}
+
+	for (unsigned int s = 0; s < b->num_vertices; s++) {
+		size_t h = (b->vertices[s].id * 0x9e3779b1U) >> (32 - bits);
+
+		while (slots[h] != 0)
+			h = (h + 1) & mask;
+		ids[h] = b->vertices[s].id;
+		slots[h] = s + 1;
+	}
+
+	free(b->table_ids);
+	free(b->table_slots);
+	b->table_ids = ids;
+	b->table_slots = slots;
+	b->table_bits = bits;
+
+	return 0;
+}
+
+/* Return the slot of an id, adding a vertex the first time it shows up. */
+static long vertex_slot(stream_builder_t *b, unsigned int id)
+{
+	size_t mask, h;
+
+	// Keep the table at most half full
+	if (2 * (size_t) (b->num_vertices + 1) > ((size_t) 1 << b->table_bits) &&
+	    table_grow(b) < 0)
+		return -ENOMEM;
+
+	mask = ((size_t) 1 << b->table_bits) - 1;
+	h = (id * 0x9e3779b1U) >> (32 - b->table_bits);
+	while (b->table_slots[h] != 0) {
+		if (b->table_ids[h] == id)
+			return b->table_slots[h] - 1;
+		h = (h + 1) & mask;
+	}
+
+	if (b->num_vertices == b->max_vertices) {
+		unsigned int max = b->max_vertices ? 2 * b->max_vertices : 4096;
+		stream_vertex_t *vertices;
+
+		vertices = realloc(b->vertices, max * sizeof(*vertices));
+		if (vertices == NULL)
+			return -ENOMEM;
+		b->vertices = vertices;
+		b->max_vertices = max;
+	}
+
+	b->vertices[b->num_vertices].id = id;
+	b->vertices[b->num_vertices].degree = 0;
+	b->vertices[b->num_vertices].head = NULL;
+	b->vertices[b->num_vertices].tail = NULL;
+	b->table_ids[h] = id;
+	b->table_slots[h] = b->num_vertices + 1;
+
+	return b->num_vertices++;
+}
+
+static int vertex_append(stream_builder_t *b, unsigned int slot, unsigned int value)
+{
+	stream_vertex_t *v = &b->vertices[slot];
+	stream_block_t *block = v->tail;
+
+	if (block == NULL || block->count == block->cap) {
+		unsigned int cap = block == NULL ? STREAM_MIN_BLOCK :
+			block->cap < STREAM_MAX_BLOCK ? 2 * block->cap : STREAM_MAX_BLOCK;
+
+		block = arena_alloc(b, sizeof(*block) + cap * sizeof(block->data[0]));
+		if (block == NULL)
+			return -ENOMEM;
+		block->next = NULL;
+		block->count = 0;
+		block->cap = cap;
+		if (v->tail != NULL)
+			v->tail->next = block;
+		else
+			v->head = block;
+		v->tail = block;
+	}
+
+	block->data[block->count++] = value;
+	v->degree++;
+
+	return 0;
+}
+
+/* Add the edge of a line, skipping blank and comment lines. */
+static int add_line(stream_builder_t *b, const char *p, const char *eol)
+{
+	unsigned int src, dst;
+	long s, d;
+	int rc;
+
+	while (p < eol && isspace((unsigned char) *p))
+		p++;
+	if (p == eol || *p == '#' || *p == '%')
+		return 0;
+
+	p = parse_uint(p, eol, &src);
+	if (p != NULL)
+		p = parse_uint(p, eol, &dst);
+	if (p == NULL)
+		return -EINVAL;
+
+	s = vertex_slot(b, src);
+	d = s < 0 ? s : vertex_slot(b, dst);
+	if (d < 0)
+		return d;
+
+	rc = vertex_append(b, s, d);
+	if (rc == 0)
+		rc = vertex_append(b, d, s);
+	b->num_edges++;
+
+	return rc;
+}
+
+static int carry_append(stream_builder_t *b, const char *p, size_t len)
+{
+	if (b->carry_len + len > b->carry_cap) {
+		size_t cap = b->carry_cap ? b->carry_cap : 256;
+		char *carry;
+
+		while (cap < b->carry_len + len)
+			cap *= 2;
+		carry = realloc(b->carry, cap);
+		if (carry == NULL)
+			return -ENOMEM;
+		b->carry = carry;
+		b->carry_cap = cap;
+	}
+
+	memcpy(b->carry + b->carry_len, p, len);
+	b->carry_len += len;
+
+	return 0;
+}
+
+/* Add the edges of a buffer; its last, incomplete line is carried over. */
+static int add_buffer(stream_builder_t *b, const char *p, size_t len)
+{
+	const char *end = p + len, *eol;
+	int rc = 0;
+
+	if (b->carry_len > 0) {
+		eol = memchr(p, '\n', len);
+		if (eol == NULL)
+			return carry_append(b, p, len);
+
+		rc = carry_append(b, p, eol - p);
+		if (rc == 0)
+			rc = add_line(b, b->carry, b->carry + b->carry_len);
+		b->carry_len = 0;
+		p = eol + 1;
+	}
+
+	while (rc == 0 && p < end) {
+		eol = memchr(p, '\n', end - p);
+		if (eol == NULL)
+			return carry_append(b, p, end - p);
+		rc = add_line(b, p, eol);
+		p = eol + 1;
+	}
+
+	return rc;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Copy the adjacency of nodes [begin, end) into the graph. */
+static void copy_adjacency(void *arg, unsigned int begin, unsigned int end)
+{
+	stream_builder_t *b = arg;
+	os_graph_t *graph = b->graph;
+
+	for (unsigned int node = begin; node < end; node++) {
+		unsigned int *out = graph->neighbours + graph->offsets[node];
+
+		for (stream_block_t *block = b->vertices[b->order[node]].head;
+		     block != NULL; block = block->next) {
+			for (unsigned int i = 0; i < block->count; i++)
+				*out++ = b->rank[block->data[i]];
+		}
+	}
+}
+
+/*
+ * Turn the vertex chains into a graph. Nodes are numbered in the order of
+ * their ids, as the SNAP reader does.
+ */
+static int finalize(os_threadpool_t *tp, stream_builder_t *b, int default_value)
+{
+	unsigned int n = b->num_vertices;
+	unsigned long long *keys;
+	os_graph_t *graph;
+
+	if (b->num_edges > UINT_MAX / 2)
+		return -EINVAL;
+
+	// Sort (id, slot) pairs packed in 64 bit keys
+	keys = malloc(((size_t) n + 1) * sizeof(*keys));
+	b->rank = malloc(((size_t) n + 1) * sizeof(*b->rank));
+	b->order = malloc(((size_t) n + 1) * sizeof(*b->order));
+	if (keys == NULL || b->rank == NULL || b->order == NULL) {
+		free(keys);
+		return -ENOMEM;
+	}
+	for (unsigned int s = 0; s < n; s++)
+		keys[s] = (unsigned long long) b->vertices[s].id << 32 | s;
+	qsort(keys, n, sizeof(*keys), compare_ids);
+	for (unsigned int node = 0; node < n; node++) {
+		b->order[node] = (unsigned int) keys[node];
+		b->rank[b->order[node]] = node;
+	}
+	free(keys);
+
+	graph = create_graph(n, b->num_edges);
+	if (graph == NULL)
+		return -ENOMEM;
+
+	for (unsigned int node = 0; node < n; node++) {
+		graph->info[node] = default_value;
+		graph->offsets[node + 1] = graph->offsets[node] +
+			b->vertices[b->order[node]].degree;
+	}
+
+	b->graph = graph;
+	parallel_for(tp, n, STREAM_COPY_GRAIN, copy_adjacency, b);
+
+	return 0;
+}
+
+static void destroy_builder(stream_builder_t *b)
+{
+	while (b->arena != NULL) {
+		stream_arena_t *next = b->arena->next;
+
+		free(b->arena);
+		b->arena = next;
+	}
+	free(b->vertices);
+	free(b->table_ids);
+	free(b->table_slots);
+	free(b->carry);
+	free(b->rank);
+	free(b->order);
+}
+
+/*
+ * Build a graph from an unbounded stream of "src dst" lines, such as a
+ * pipe from the job producing the edges, in the SNAP edge list format.
+ * A reader thread fills large buffers while the calling thread parses the
+ * previous ones into per-vertex chains of blocks, so parsing overlaps with
+ * the producer. At the end of the stream the chains are copied in a
+ * compact adjacency, in parallel on tp (serially if tp is NULL). Every
+ * node gets default_value. The start_len bytes at start, which may be
+ * NULL, were already read from fd, for instance to detect the format; they
+ * are parsed first.
+ */
+os_graph_t *create_graph_from_stream(os_threadpool_t *tp, int fd,
+		const char *start, size_t start_len, int default_value)
+{
+	stream_reader_t reader;
+	stream_builder_t builder;
+	pthread_t thread;
+	int rc = 0, idx;
+
+	memset(&reader, 0, sizeof(reader));
+	memset(&builder, 0, sizeof(builder));
+	reader.fd = fd;
+
+	for (int i = 0; i < STREAM_NUM_BUFFERS; i++) {
+		reader.bufs[i] = malloc(STREAM_BUFFER_SIZE);
+		if (reader.bufs[i] == NULL)
+			rc = -ENOMEM;
+	}
+	if (rc == 0)
+		rc = table_grow(&builder);
+	if (rc < 0)
+		goto out;
+
+	pthread_mutex_init(&reader.mutex, NULL);
+	pthread_cond_init(&reader.cond, NULL);
+	rc = -pthread_create(&thread, NULL, reader_thread, &reader);
+	if (rc < 0)
+		goto destroy_sync;
+
+	if (start_len > 0)
+		rc = add_buffer(&builder, start, start_len);
+	while (rc == 0 && (idx = reader_next(&reader)) >= 0) {
+		rc = add_buffer(&builder, reader.bufs[idx], reader.lens[idx]);
+		reader_release(&reader);
+	}
+	if (rc < 0)
+		reader_stop(&reader, rc);
+	pthread_join(thread, NULL);
+
+	if (rc == 0)
+		rc = reader.error;
+	if (rc == 0 && builder.carry_len > 0)
+		rc = add_line(&builder, builder.carry, builder.carry + builder.carry_len);
+	if (rc == 0)
+		rc = finalize(tp, &builder, default_value);
+
+destroy_sync:
+	pthread_mutex_destroy(&reader.mutex);
+	pthread_cond_destroy(&reader.cond);
+out:
+	if (rc < 0) {
+		if (rc == -EINVAL)
+			log_error("Invalid edge stream");
+		else
+			log_error("Can't read the edge stream: %s", strerror(-rc));
+	}
+
+	destroy_builder(&builder);
+	for (int i = 0; i < STREAM_NUM_BUFFERS; i++)
+		free(reader.bufs[i]);
+
+	return rc < 0 ? NULL : builder.graph;
+}
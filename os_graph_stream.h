@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_GRAPH_STREAM_H__
+#define __OS_GRAPH_STREAM_H__	1
+
+#include <stddef.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+os_graph_t *create_graph_from_stream(os_threadpool_t *tp, int fd,
+		const char *start, size_t start_len, int default_value);
+
+#endif
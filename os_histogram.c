@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "os_histogram.h"
+
+// Shard of the calling thread, assigned on its first record
+static __thread int thread_shard = -1;
+static unsigned int next_shard;
+
+unsigned long long histogram_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int bucket_of(unsigned long long value)
+{
+	unsigned int shift;
+
+	if (value < OS_HISTOGRAM_SUB_COUNT)
+		return value;
+
+	// value >> shift is in [SUB_COUNT, 2 * SUB_COUNT)
+	shift = 63 - __builtin_clzll(value) - OS_HISTOGRAM_SUB_BITS;
+
+	return (shift + 1) * OS_HISTOGRAM_SUB_COUNT +
+		(value >> shift) - OS_HISTOGRAM_SUB_COUNT;
+}
+
+/* Highest value falling in a bucket. */
+static unsigned long long bucket_max(unsigned int bucket)
+{
+	unsigned int shift;
+	unsigned long long sub;
+
+	if (bucket < OS_HISTOGRAM_SUB_COUNT)
+		return bucket;
+
+	shift = bucket / OS_HISTOGRAM_SUB_COUNT - 1;
+	sub = bucket % OS_HISTOGRAM_SUB_COUNT + OS_HISTOGRAM_SUB_COUNT;
+
+	return ((sub + 1) << shift) - 1;
+}
+
+os_histogram_t *create_histogram(void)
+{
+	os_histogram_t *hist;
+
+	hist = calloc(1, sizeof(*hist));
+	if (hist == NULL)
+		return NULL;
+
+	hist->start_ns = histogram_clock_ns();
+
+	return hist;
+}
+
+void destroy_histogram(os_histogram_t *hist)
+{
+	free(hist);
+}
+
+/* Clear the counts and restart the measurement. Not atomic w.r.t. records. */
+void histogram_reset(os_histogram_t *hist)
+{
+	memset(hist->shards, 0, sizeof(hist->shards));
+	hist->start_ns = histogram_clock_ns();
+}
+
+void histogram_record(os_histogram_t *hist, unsigned long long value)
+{
+	if (thread_shard < 0)
+		thread_shard = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) %
+			OS_HISTOGRAM_SHARDS;
+
+	__atomic_add_fetch(&hist->shards[thread_shard].counts[bucket_of(value)], 1,
+			__ATOMIC_RELAXED);
+}
+
+/* Sum the shards; records running concurrently may or may not be seen. */
+static unsigned long long merge(os_histogram_t *hist, unsigned long long *counts)
+{
+	unsigned long long total = 0;
+
+	memset(counts, 0, OS_HISTOGRAM_BUCKETS * sizeof(*counts));
+	for (unsigned int s = 0; s < OS_HISTOGRAM_SHARDS; s++) {
+		for (unsigned int b = 0; b < OS_HISTOGRAM_BUCKETS; b++) {
+			unsigned long long c;
+
+			c = __atomic_load_n(&hist->shards[s].counts[b], __ATOMIC_RELAXED);
+			counts[b] += c;
+			total += c;
+		}
+	}
+
+	return total;
+}
+
+/* Value at a percentile in merged counts, 0 if there is none. */
+static unsigned long long value_at(unsigned long long *counts, unsigned long long total,
+		double percentile)
+{
+	unsigned long long rank, seen = 0;
+
+	if (total == 0)
+		return 0;
+
+	rank = (unsigned long long) (percentile / 100.0 * total + 0.5);
+	if (rank == 0)
+		rank = 1;
+	if (rank > total)
+		rank = total;
+
+	for (unsigned int b = 0; b < OS_HISTOGRAM_BUCKETS; b++) {
+		seen += counts[b];
+		if (seen >= rank)
+			return bucket_max(b);
+	}
+
+	return 0;
+}
+
+unsigned long long histogram_percentile(os_histogram_t *hist, double percentile)
+{
+	unsigned long long counts[OS_HISTOGRAM_BUCKETS];
+	unsigned long long total;
+
+	total = merge(hist, counts);
+
+	return value_at(counts, total, percentile);
+}
+
+void histogram_summary(os_histogram_t *hist, os_histogram_summary_t *summary)
+{
+	unsigned long long counts[OS_HISTOGRAM_BUCKETS];
+	unsigned long long elapsed;
+
+	memset(summary, 0, sizeof(*summary));
+
+	summary->count = merge(hist, counts);
+	if (summary->count == 0)
+		return;
+
+	summary->min = value_at(counts, summary->count, 0);
+	summary->max = value_at(counts, summary->count, 100);
+	summary->p50 = value_at(counts, summary->count, 50);
+	summary->p90 = value_at(counts, summary->count, 90);
+	summary->p99 = value_at(counts, summary->count, 99);
+	summary->p999 = value_at(counts, summary->count, 99.9);
+
+	elapsed = histogram_clock_ns() - hist->start_ns;
+	if (elapsed > 0)
+		summary->throughput = summary->count * 1e9 / elapsed;
+}
+
+/* Print a one line summary of a histogram of nanosecond latencies. */
+void print_histogram_summary(os_histogram_t *hist, const char *name, FILE *file)
+{
+	os_histogram_summary_t s;
+
+	histogram_summary(hist, &s);
+
+	fprintf(file, "%s: count %llu, qps %.1f, min %.1fus, p50 %.1fus, p90 %.1fus, "
+		"p99 %.1fus, p99.9 %.1fus, max %.1fus\n",
+		name, s.count, s.throughput, s.min / 1e3, s.p50 / 1e3, s.p90 / 1e3,
+		s.p99 / 1e3, s.p999 / 1e3, s.max / 1e3);
+}
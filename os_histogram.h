@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_HISTOGRAM_H__
+#define __OS_HISTOGRAM_H__	1
+
+#include <stdio.h>
+
+/*
+ * Log-linear histogram (HDR style): values are grouped by power of two,
+ * and every power of two is split in OS_HISTOGRAM_SUB_COUNT linear
+ * buckets, which bounds the relative error to 1 / OS_HISTOGRAM_SUB_COUNT.
+ *
+ * Counts are spread over shards, a thread always records in the same
+ * shard with a relaxed atomic add, so recording is lock-free and does not
+ * bounce cache lines between threads. Readers merge the shards.
+ */
+#define OS_HISTOGRAM_SUB_BITS	5
+#define OS_HISTOGRAM_SUB_COUNT	(1U << OS_HISTOGRAM_SUB_BITS)
+#define OS_HISTOGRAM_BUCKETS	((64 - OS_HISTOGRAM_SUB_BITS + 1) * OS_HISTOGRAM_SUB_COUNT)
+#define OS_HISTOGRAM_SHARDS	16
+
+typedef struct os_histogram_shard_t {
+	unsigned long long counts[OS_HISTOGRAM_BUCKETS];
+} os_histogram_shard_t;
+
+typedef struct os_histogram_t {
+	os_histogram_shard_t shards[OS_HISTOGRAM_SHARDS];
+
+	// Start of the measurement, used to compute the throughput
+	unsigned long long start_ns;
+} os_histogram_t;
+
+typedef struct os_histogram_summary_t {
+	unsigned long long count;
+	unsigned long long min, max;
+	unsigned long long p50, p90, p99, p999;
+
+	// Recorded values per second since the start of the measurement
+	double throughput;
+} os_histogram_summary_t;
+
+os_histogram_t *create_histogram(void);
+void destroy_histogram(os_histogram_t *hist);
+void histogram_reset(os_histogram_t *hist);
+void histogram_record(os_histogram_t *hist, unsigned long long value);
+unsigned long long histogram_percentile(os_histogram_t *hist, double percentile);
+void histogram_summary(os_histogram_t *hist, os_histogram_summary_t *summary);
+void print_histogram_summary(os_histogram_t *hist, const char *name, FILE *file);
+
+unsigned long long histogram_clock_ns(void);
+
+#endif
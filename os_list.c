@@ -1,11 +1,18 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
 #include "os_list.h"
-#include "os_graph.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 
+void queue_init(os_queue_t *queue)
+{
+	queue->stub.next = NULL;
+	queue->stub.prev = NULL;
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+}
+
 os_queue_t *queue_create(void)
 {
 	os_queue_t *queue;
@@ -15,46 +22,70 @@ os_queue_t *queue_create(void)
 		perror("malloc");
 		return NULL;
 	}
-	pthread_mutex_init(&queue->lock, NULL);
-	queue->first =  NULL;
-	queue->last = NULL;
+	queue_init(queue);
 
 	return queue;
 }
 
-void queue_add(os_queue_t *queue, void *info)
+/* The queue does not own its nodes, they must be drained by the caller. */
+void queue_destroy(os_queue_t *queue)
 {
-	os_list_node_t *node;
+	free(queue);
+}
 
-	node = malloc(sizeof(*node));
-	if (node == NULL) {
-		fprintf(stderr, "[ERROR] %s: Not enough memory\n", __func__);
-		return;
-	}
+void queue_add(os_queue_t *queue, os_list_node_t *node)
+{
+	os_list_node_t *prev;
 
-	node->next = NULL;
-	node->info = info;
+	__atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
 
-	if (queue->last == NULL && queue->first == NULL) {
-		queue->first = node;
-		queue->last = node;
-	} else {
-		queue->last->next = node;
-		queue->last = node;
-	}
+	// Serialization point between producers
+	prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+
+	// Link the previous head to the new node, making it visible to the consumer
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
 }
 
 os_list_node_t *queue_get(os_queue_t *queue)
 {
-	os_list_node_t *target;
+	os_list_node_t *tail = queue->tail;
+	os_list_node_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
 
-	if (queue == NULL)
-		return NULL;
-	if (queue->first == NULL && queue->last == NULL)
+	// Skip over the stub node
+	if (tail == &queue->stub) {
+		if (next == NULL)
+			return NULL;
+		queue->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next != NULL) {
+		queue->tail = next;
+		return tail;
+	}
+
+	// A producer has swapped the head but not yet linked its node
+	if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
 		return NULL;
 
-	target = queue->first;
-	queue->first = queue->first->next;
+	// tail is the last node: push the stub back so tail can be detached
+	queue_add(queue, &queue->stub);
+
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next != NULL) {
+		queue->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+/* Only meaningful from the consumer side. */
+int queue_empty(os_queue_t *queue)
+{
+	os_list_node_t *tail = queue->tail;
 
-	return target;
+	return tail == &queue->stub &&
+		__atomic_load_n(&tail->next, __ATOMIC_ACQUIRE) == NULL;
 }
@@ -61,4 +61,25 @@ static inline int list_empty(os_list_node_t *head)
 	for (pos = (head)->next, tmp = pos->next; pos != (head); \
 			pos = tmp, tmp = pos->next)
 
+/*
+ * Intrusive multi-producer/single-consumer queue (Dmitry Vyukov's design).
+ * Nodes are linked through their next field only; prev is left untouched.
+ * queue_add() is wait-free and may be called concurrently from any thread.
+ * queue_get() must only be called by one consumer at a time. It may return
+ * NULL while a producer is half-way through queue_add(), even though the
+ * queue is not empty; the element becomes visible once the producer is done.
+ */
+typedef struct os_queue_t {
+	os_list_node_t *head;		/* last pushed node, producers side */
+	os_list_node_t *tail;		/* next node to pop, consumer side */
+	os_list_node_t stub;
+} os_queue_t;
+
+void queue_init(os_queue_t *queue);
+os_queue_t *queue_create(void);
+void queue_destroy(os_queue_t *queue);
+void queue_add(os_queue_t *queue, os_list_node_t *node);
+os_list_node_t *queue_get(os_queue_t *queue);
+int queue_empty(os_queue_t *queue);
+
 #endif
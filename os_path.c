@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "os_path.h"
+
+#define PATH_NO_NODE		UINT_MAX
+// Frontier nodes expanded by each task
+#define PATH_GRAIN		256
+// Nodes a task gathers before appending them to the next frontier
+#define PATH_LOCAL_NODES	256
+
+/*
+ * One direction of the search. The nodes it reached are the keys of an
+ * open addressing table, which also holds their BFS parent; a node is
+ * claimed by the CAS filling its slot. The table is only grown between
+ * levels, when no task uses it.
+ */
+typedef struct {
+	unsigned int *keys, *parents;
+	size_t mask;
+	unsigned int count;
+
+	unsigned int *frontier, *next;
+	unsigned int num_frontier, num_next;
+	size_t frontier_cap;
+	// Sum of the degrees of the frontier, the work of its expansion
+	unsigned long long frontier_edges, next_edges;
+	unsigned int depth;
+} path_side_t;
+
+typedef struct {
+	os_graph_t *graph;
+	path_side_t *self, *other;
+
+	// First edge found between the two searches
+	bool met;
+	unsigned int meet_self, meet_other;
+} path_ctx_t;
+
+static inline size_t hash_node(unsigned int node, size_t mask)
+{
+	return ((uint64_t) node * 0x9e3779b97f4a7c15ULL >> 32) & mask;
+}
+
+static bool side_contains(path_side_t *side, unsigned int node)
+{
+	for (size_t h = hash_node(node, side->mask); ; h = (h + 1) & side->mask) {
+		unsigned int key = side->keys[h];
+
+		if (key == node)
+			return true;
+		if (key == PATH_NO_NODE)
+			return false;
+	}
+}
+
+/* Claim a node for this side, return true if it was not reached yet. */
+static bool side_claim(path_side_t *side, unsigned int node, unsigned int parent)
+{
+	for (size_t h = hash_node(node, side->mask); ; h = (h + 1) & side->mask) {
+		unsigned int key = __atomic_load_n(&side->keys[h], __ATOMIC_RELAXED);
+
+		if (key == PATH_NO_NODE) {
+			if (__atomic_compare_exchange_n(&side->keys[h], &key, node, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				side->parents[h] = parent;
+				__atomic_add_fetch(&side->count, 1, __ATOMIC_RELAXED);
+				return true;
+			}
+			// The failed CAS loaded the node which won the slot
+		}
+		if (key == node)
+			return false;
+	}
+}
+
+static unsigned int side_parent(path_side_t *side, unsigned int node)
+{
+	for (size_t h = hash_node(node, side->mask); ; h = (h + 1) & side->mask) {
+		if (side->keys[h] == node)
+			return side->parents[h];
+	}
+}
+
+/* Make room for n more nodes, keeping the table at most half full. */
+static int side_reserve(path_side_t *side, unsigned long long n)
+{
+	size_t size = side->mask + 1, new_size = size;
+	unsigned int *keys, *parents;
+
+	while ((unsigned long long) new_size < 2 * (side->count + n))
+		new_size *= 2;
+	if (new_size == size)
+		return 0;
+
+	keys = malloc(new_size * sizeof(*keys));
+	parents = malloc(new_size * sizeof(*parents));
+	if (keys == NULL || parents == NULL) {
+		free(keys);
+		free(parents);
+		return -ENOMEM;
+	}
+	memset(keys, 0xff, new_size * sizeof(*keys));
+
+	for (size_t i = 0; i < size; i++) {
+		size_t h;
+
+		if (side->keys[i] == PATH_NO_NODE)
+			continue;
+		for (h = hash_node(side->keys[i], new_size - 1); keys[h] != PATH_NO_NODE;
+		     h = (h + 1) & (new_size - 1))
+			;
+		keys[h] = side->keys[i];
+		parents[h] = side->parents[i];
+	}
+
+	free(side->keys);
+	free(side->parents);
+	side->keys = keys;
+	side->parents = parents;
+	side->mask = new_size - 1;
+
+	return 0;
+}
+
+static int side_init(path_side_t *side, os_graph_t *graph, unsigned int root)
+{
+	memset(side, 0, sizeof(*side));
+	side->mask = 63;
+	side->keys = malloc((side->mask + 1) * sizeof(*side->keys));
+	side->parents = malloc((side->mask + 1) * sizeof(*side->parents));
+	side->frontier_cap = 64;
+	side->frontier = malloc(side->frontier_cap * sizeof(*side->frontier));
+	side->next = malloc(side->frontier_cap * sizeof(*side->next));
+	if (side->keys == NULL || side->parents == NULL ||
+	    side->frontier == NULL || side->next == NULL)
+		return -ENOMEM;
+	memset(side->keys, 0xff, (side->mask + 1) * sizeof(*side->keys));
+
+	side_claim(side, root, root);
+	side->frontier[0] = root;
+	side->num_frontier = 1;
+	side->frontier_edges = graph_degree(graph, root);
+
+	return 0;
+}
+
+static void side_destroy(path_side_t *side)
+{
+	free(side->keys);
+	free(side->parents);
+	free(side->frontier);
+	free(side->next);
+}
+
+static void append_next(path_side_t *side, unsigned int *nodes, unsigned int n,
+		unsigned long long edges)
+{
+	unsigned int pos = __atomic_fetch_add(&side->num_next, n, __ATOMIC_RELAXED);
+
+	memcpy(side->next + pos, nodes, n * sizeof(*nodes));
+	__atomic_add_fetch(&side->next_edges, edges, __ATOMIC_RELAXED);
+}
+
+/* Expand frontier nodes [begin, end) of the searching side. */
+static void expand_range(void *arg, unsigned int begin, unsigned int end)
+{
+	path_ctx_t *ctx = arg;
+	path_side_t *self = ctx->self;
+	unsigned int local[PATH_LOCAL_NODES], num_local = 0;
+	unsigned long long local_edges = 0;
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int u = self->frontier[i];
+		unsigned int *neighbours = graph_neighbours(ctx->graph, u);
+
+		if (__atomic_load_n(&ctx->met, __ATOMIC_RELAXED))
+			break;
+
+		for (unsigned int j = 0; j < graph_degree(ctx->graph, u); j++) {
+			unsigned int v = neighbours[j];
+			bool expected = false;
+
+			// The other side is not modified while this one expands
+			if (side_contains(ctx->other, v)) {
+				if (__atomic_compare_exchange_n(&ctx->met, &expected, true,
+						false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					ctx->meet_self = u;
+					ctx->meet_other = v;
+				}
+				break;
+			}
+
+			if (!side_claim(self, v, u))
+				continue;
+			local[num_local++] = v;
+			local_edges += graph_degree(ctx->graph, v);
+			if (num_local == PATH_LOCAL_NODES) {
+				append_next(self, local, num_local, local_edges);
+				num_local = 0;
+				local_edges = 0;
+			}
+		}
+	}
+
+	if (num_local > 0)
+		append_next(self, local, num_local, local_edges);
+}
+
+/* Expand one level of a side; the next frontier can't outgrow the graph. */
+static int expand_level(os_threadpool_t *tp, path_ctx_t *ctx)
+{
+	path_side_t *self = ctx->self;
+	unsigned long long bound = self->frontier_edges;
+	unsigned int *tmp;
+	int rc;
+
+	if (bound > ctx->graph->num_nodes - self->count)
+		bound = ctx->graph->num_nodes - self->count;
+
+	rc = side_reserve(self, bound);
+	if (rc < 0)
+		return rc;
+
+	if (bound > self->frontier_cap) {
+		size_t cap = self->frontier_cap;
+
+		while (cap < bound)
+			cap *= 2;
+		tmp = realloc(self->next, cap * sizeof(*tmp));
+		if (tmp == NULL)
+			return -ENOMEM;
+		self->next = tmp;
+		tmp = realloc(self->frontier, cap * sizeof(*tmp));
+		if (tmp == NULL)
+			return -ENOMEM;
+		self->frontier = tmp;
+		self->frontier_cap = cap;
+	}
+
+	self->num_next = 0;
+	self->next_edges = 0;
+	parallel_for(tp, self->num_frontier, PATH_GRAIN, expand_range, ctx);
+
+	tmp = self->frontier;
+	self->frontier = self->next;
+	self->next = tmp;
+	self->num_frontier = self->num_next;
+	self->frontier_edges = self->next_edges;
+	self->depth++;
+
+	return 0;
+}
+
+/* Build the path through the meeting edge, from the source to the target. */
+static int build_path(path_ctx_t *ctx, path_side_t *from_source,
+		path_side_t *from_target, os_path_result_t *result)
+{
+	unsigned int near_source, near_target, node, len = 0;
+	unsigned int *path;
+
+	if (ctx->self == from_source) {
+		near_source = ctx->meet_self;
+		near_target = ctx->meet_other;
+	} else {
+		near_source = ctx->meet_other;
+		near_target = ctx->meet_self;
+	}
+
+	path = malloc((result->distance + 1) * sizeof(*path));
+	if (path == NULL)
+		return -ENOMEM;
+
+	// Walk up to the source, then reverse that half
+	for (node = near_source; ; node = side_parent(from_source, node)) {
+		path[len++] = node;
+		if (side_parent(from_source, node) == node)
+			break;
+	}
+	for (unsigned int i = 0; i < len / 2; i++) {
+		unsigned int tmp = path[i];
+
+		path[i] = path[len - 1 - i];
+		path[len - 1 - i] = tmp;
+	}
+
+	for (node = near_target; ; node = side_parent(from_target, node)) {
+		path[len++] = node;
+		if (side_parent(from_target, node) == node)
+			break;
+	}
+
+	result->path = path;
+	return 0;
+}
+
+/*
+ * Find the distance between two nodes, and a shortest path if asked for,
+ * with a level synchronous bidirectional BFS. Each step expands one level
+ * of the side whose frontier has the fewest edges, in parallel on tp
+ * (serially if tp is NULL), and the search stops at the first edge joining
+ * the two sides: the balls around the source and the target were disjoint
+ * before that level, so the distance is the sum of their depths plus one.
+ * Memory and time depend on the nodes reached, not on the graph size.
+ * Returns result->error.
+ */
+int shortest_path(os_threadpool_t *tp, os_graph_t *graph, unsigned int source,
+		unsigned int target, bool want_path, os_path_result_t *result)
+{
+	path_side_t sides[2];
+	path_ctx_t ctx;
+	int rc;
+
+	memset(result, 0, sizeof(*result));
+	if (source >= graph->num_nodes || target >= graph->num_nodes) {
+		result->error = -EINVAL;
+		return result->error;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.graph = graph;
+
+	rc = side_init(&sides[0], graph, source);
+	if (rc == 0)
+		rc = side_init(&sides[1], graph, target);
+	else
+		memset(&sides[1], 0, sizeof(sides[1]));
+	if (rc < 0)
+		goto out;
+
+	if (source == target) {
+		result->connected = true;
+		if (want_path) {
+			result->path = malloc(sizeof(*result->path));
+			if (result->path == NULL)
+				rc = -ENOMEM;
+			else
+				result->path[0] = source;
+		}
+		goto out;
+	}
+
+	while (sides[0].num_frontier > 0 && sides[1].num_frontier > 0) {
+		int s = sides[0].frontier_edges <= sides[1].frontier_edges ? 0 : 1;
+
+		ctx.self = &sides[s];
+		ctx.other = &sides[1 - s];
+		rc = expand_level(tp, &ctx);
+		if (rc < 0)
+			goto out;
+
+		if (ctx.met) {
+			result->connected = true;
+			result->distance = sides[0].depth + sides[1].depth;
+			if (want_path)
+				rc = build_path(&ctx, &sides[0], &sides[1], result);
+			break;
+		}
+	}
+
+out:
+	result->num_visited = sides[0].count + sides[1].count;
+	side_destroy(&sides[0]);
+	side_destroy(&sides[1]);
+	result->error = rc;
+
+	return rc;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_PATH_H__
+#define __OS_PATH_H__	1
+
+#include <stdbool.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+/* Result of one point to point query. */
+typedef struct os_path_result_t {
+	// 0 on success, a negative errno value otherwise
+	int error;
+
+	bool connected;
+	unsigned int distance;
+
+	// If asked for, the distance + 1 nodes of a shortest path, to free()
+	unsigned int *path;
+
+	// Nodes reached by the two searches
+	unsigned int num_visited;
+} os_path_result_t;
+
+int shortest_path(os_threadpool_t *tp, os_graph_t *graph, unsigned int source,
+		unsigned int target, bool want_path, os_path_result_t *result);
+
+#endif
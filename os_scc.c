@@ -0,0 +1,500 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "os_scc.h"
+#include "log/log.h"
+
+#define SCC_GRAIN		1024
+// Trimming rounds before the remaining nodes are left to the next steps
+#define SCC_TRIM_ROUNDS		8
+// Representative of the nodes whose component is not known yet
+#define SCC_ACTIVE		UINT_MAX
+
+#define MARK_FORWARD		1
+#define MARK_BACKWARD		2
+
+typedef struct {
+	os_threadpool_t *tp;
+	os_graph_t *graph;
+
+	// Node of the component of each node, SCC_ACTIVE until it is found
+	unsigned int *rep;
+	// Nodes whose component is not known, as of the last compaction
+	unsigned int *active;
+	unsigned int num_active;
+
+	// Frontier of the current search, the next one is filled atomically
+	unsigned int *frontier, *next;
+	unsigned int next_size;
+	uint8_t *mark;
+	uint8_t direction;
+	unsigned int pivot;
+
+	// Largest node reaching each node, for the coloring step
+	unsigned int *color;
+
+	// Per task counts, or pivot candidates
+	unsigned int *partial;
+	unsigned int num_tasks;
+} scc_ctx_t;
+
+static inline bool is_active(scc_ctx_t *ctx, unsigned int idx)
+{
+	return __atomic_load_n(&ctx->rep[idx], __ATOMIC_RELAXED) == SCC_ACTIVE;
+}
+
+/* Whether a list holds an active node other than idx. */
+static bool has_active(scc_ctx_t *ctx, const unsigned int *nb, unsigned int degree,
+		unsigned int idx)
+{
+	for (unsigned int i = 0; i < degree; i++) {
+		if (nb[i] != idx && is_active(ctx, nb[i]))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * A node with no active in- or out-neighbour is on no cycle of active
+ * nodes: it is a component by itself. Nodes are removed as they are found,
+ * which may uncover more of them in the same round.
+ */
+static void trim_nodes(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+	unsigned int count = 0;
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int v = ctx->active[i];
+
+		if (!has_active(ctx, graph_out_neighbours(graph, v),
+				graph_out_degree(graph, v), v) ||
+		    !has_active(ctx, graph_in_neighbours(graph, v),
+				graph_in_degree(graph, v), v)) {
+			__atomic_store_n(&ctx->rep[v], v, __ATOMIC_RELAXED);
+			count++;
+		}
+	}
+
+	ctx->partial[begin / SCC_GRAIN] = count;
+}
+
+static unsigned int sum_partial(scc_ctx_t *ctx, unsigned int n)
+{
+	unsigned int sum = 0;
+
+	for (unsigned int c = 0; c < (n + SCC_GRAIN - 1) / SCC_GRAIN; c++)
+		sum += ctx->partial[c];
+
+	return sum;
+}
+
+static void count_active(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+	unsigned int count = 0;
+
+	for (unsigned int i = begin; i < end; i++)
+		count += is_active(ctx, ctx->active[i]);
+
+	ctx->partial[begin / SCC_GRAIN] = count;
+}
+
+static void copy_active(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+	unsigned int pos = ctx->partial[begin / SCC_GRAIN];
+
+	for (unsigned int i = begin; i < end; i++) {
+		if (is_active(ctx, ctx->active[i]))
+			ctx->next[pos++] = ctx->active[i];
+	}
+}
+
+/* Drop the nodes whose component was found from the active list. */
+static void compact_active(scc_ctx_t *ctx)
+{
+	unsigned int n = ctx->num_active, pos = 0, *tmp;
+
+	parallel_for(ctx->tp, n, SCC_GRAIN, count_active, ctx);
+	for (unsigned int c = 0; c < (n + SCC_GRAIN - 1) / SCC_GRAIN; c++) {
+		unsigned int count = ctx->partial[c];
+
+		ctx->partial[c] = pos;
+		pos += count;
+	}
+	parallel_for(ctx->tp, n, SCC_GRAIN, copy_active, ctx);
+
+	tmp = ctx->active, ctx->active = ctx->next, ctx->next = tmp;
+	ctx->num_active = pos;
+}
+
+static void find_pivot(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+	unsigned long long best = 0;
+	unsigned int pivot = ctx->active[begin];
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int v = ctx->active[i];
+		unsigned long long w = (unsigned long long) graph_out_degree(ctx->graph, v) *
+			graph_in_degree(ctx->graph, v);
+
+		if (w > best) {
+			best = w;
+			pivot = v;
+		}
+	}
+
+	ctx->partial[begin / SCC_GRAIN] = pivot;
+}
+
+/*
+ * Active node most likely to be in the largest component: the one with the
+ * largest product of its in- and out-degrees.
+ */
+static unsigned int choose_pivot(scc_ctx_t *ctx)
+{
+	os_graph_t *graph = ctx->graph;
+	unsigned long long best = 0;
+	unsigned int pivot = ctx->active[0];
+
+	parallel_for(ctx->tp, ctx->num_active, SCC_GRAIN, find_pivot, ctx);
+	for (unsigned int c = 0; c < (ctx->num_active + SCC_GRAIN - 1) / SCC_GRAIN; c++) {
+		unsigned int v = ctx->partial[c];
+		unsigned long long w = (unsigned long long) graph_out_degree(graph, v) *
+			graph_in_degree(graph, v);
+
+		if (w > best) {
+			best = w;
+			pivot = v;
+		}
+	}
+
+	return pivot;
+}
+
+/* Mark the active nodes one step from the frontier in the current direction. */
+static void expand_reach(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+	uint8_t bit = ctx->direction;
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int v = ctx->frontier[i];
+		unsigned int *nb = bit == MARK_FORWARD ? graph_out_neighbours(graph, v) :
+			graph_in_neighbours(graph, v);
+		unsigned int degree = bit == MARK_FORWARD ? graph_out_degree(graph, v) :
+			graph_in_degree(graph, v);
+
+		for (unsigned int j = 0; j < degree; j++) {
+			unsigned int w = nb[j];
+
+			if (!is_active(ctx, w) ||
+			    (__atomic_load_n(&ctx->mark[w], __ATOMIC_RELAXED) & bit) ||
+			    (__atomic_fetch_or(&ctx->mark[w], bit, __ATOMIC_RELAXED) & bit))
+				continue;
+			ctx->next[__atomic_fetch_add(&ctx->next_size, 1, __ATOMIC_RELAXED)] = w;
+		}
+	}
+}
+
+/*
+ * Breadth first search over the active nodes, one frontier at a time split
+ * across the workers, starting from the size nodes of the frontier.
+ */
+static void search(scc_ctx_t *ctx, unsigned int size,
+		void (*expand)(void *arg, unsigned int begin, unsigned int end))
+{
+	unsigned int *tmp;
+
+	while (size > 0) {
+		ctx->next_size = 0;
+		parallel_for(ctx->tp, size, SCC_GRAIN, expand, ctx);
+
+		size = ctx->next_size;
+		tmp = ctx->frontier, ctx->frontier = ctx->next, ctx->next = tmp;
+	}
+}
+
+static void collect_pivot_scc(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+	unsigned int count = 0;
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int v = ctx->active[i];
+
+		if (ctx->mark[v] == (MARK_FORWARD | MARK_BACKWARD)) {
+			ctx->rep[v] = ctx->pivot;
+			count++;
+		}
+		ctx->mark[v] = 0;
+	}
+
+	ctx->partial[begin / SCC_GRAIN] = count;
+}
+
+/*
+ * The component of the pivot is the set of nodes both reachable from it
+ * and reaching it. Return its size.
+ */
+static unsigned int forward_backward(scc_ctx_t *ctx, unsigned int pivot)
+{
+	ctx->pivot = pivot;
+	ctx->direction = MARK_FORWARD;
+	ctx->mark[pivot] = MARK_FORWARD;
+	ctx->frontier[0] = pivot;
+	search(ctx, 1, expand_reach);
+
+	ctx->direction = MARK_BACKWARD;
+	ctx->mark[pivot] |= MARK_BACKWARD;
+	ctx->frontier[0] = pivot;
+	search(ctx, 1, expand_reach);
+
+	parallel_for(ctx->tp, ctx->num_active, SCC_GRAIN, collect_pivot_scc, ctx);
+
+	return sum_partial(ctx, ctx->num_active);
+}
+
+static void init_colors(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+
+	for (unsigned int i = begin; i < end; i++)
+		ctx->color[ctx->active[i]] = ctx->active[i];
+}
+
+/* Push the color of each node to its out-neighbours with a smaller one. */
+static void propagate_colors(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+	unsigned int count = 0;
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int v = ctx->active[i];
+		unsigned int c = __atomic_load_n(&ctx->color[v], __ATOMIC_RELAXED);
+		unsigned int *nb = graph_out_neighbours(graph, v);
+
+		for (unsigned int j = 0; j < graph_out_degree(graph, v); j++) {
+			unsigned int w = nb[j];
+			unsigned int cw = __atomic_load_n(&ctx->color[w], __ATOMIC_RELAXED);
+
+			if (!is_active(ctx, w))
+				continue;
+			while (cw < c) {
+				if (__atomic_compare_exchange_n(&ctx->color[w], &cw, c, false,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					count++;
+					break;
+				}
+			}
+		}
+	}
+
+	ctx->partial[begin / SCC_GRAIN] = count;
+}
+
+/* Nodes keeping their own color start the backward searches. */
+static void collect_roots(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int v = ctx->active[i];
+
+		if (ctx->color[v] == v) {
+			ctx->rep[v] = v;
+			ctx->frontier[__atomic_fetch_add(&ctx->next_size, 1,
+					__ATOMIC_RELAXED)] = v;
+		}
+	}
+}
+
+/* Claim the in-neighbours of the frontier of the same color. */
+static void expand_color(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int v = ctx->frontier[i], c = ctx->color[v];
+		unsigned int *nb = graph_in_neighbours(graph, v);
+
+		for (unsigned int j = 0; j < graph_in_degree(graph, v); j++) {
+			unsigned int w = nb[j], expected = SCC_ACTIVE;
+
+			if (ctx->color[w] != c || !is_active(ctx, w) ||
+			    !__atomic_compare_exchange_n(&ctx->rep[w], &expected, c, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				continue;
+			ctx->next[__atomic_fetch_add(&ctx->next_size, 1, __ATOMIC_RELAXED)] = w;
+		}
+	}
+}
+
+/*
+ * Coloring step: every node takes the color of the largest node reaching
+ * it. A node keeping its own color is the largest of its component, which
+ * is made of the nodes of its color reaching it. Each round finds at least
+ * the component of the largest active node.
+ */
+static unsigned int color_components(scc_ctx_t *ctx)
+{
+	unsigned int found = 0, before;
+
+	while (ctx->num_active > 0) {
+		before = ctx->num_active;
+
+		parallel_for(ctx->tp, ctx->num_active, SCC_GRAIN, init_colors, ctx);
+		do {
+			parallel_for(ctx->tp, ctx->num_active, SCC_GRAIN,
+				     propagate_colors, ctx);
+		} while (sum_partial(ctx, ctx->num_active) > 0);
+
+		ctx->next_size = 0;
+		parallel_for(ctx->tp, ctx->num_active, SCC_GRAIN, collect_roots, ctx);
+		search(ctx, ctx->next_size, expand_color);
+
+		compact_active(ctx);
+		found += before - ctx->num_active;
+	}
+
+	return found;
+}
+
+/* Number the components by their smallest node and count their nodes. */
+static int number_components(scc_ctx_t *ctx, os_scc_t *scc)
+{
+	unsigned int n = ctx->graph->num_nodes, k = 0;
+	unsigned int *id = ctx->color;
+
+	memset(id, 0xff, n * sizeof(*id));
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned int r = ctx->rep[i];
+
+		if (id[r] == SCC_ACTIVE)
+			id[r] = k++;
+		scc->component[i] = id[r];
+	}
+
+	scc->num_components = k;
+	scc->sizes = calloc(k + 1, sizeof(*scc->sizes));
+	if (scc->sizes == NULL)
+		return -ENOMEM;
+
+	for (unsigned int i = 0; i < n; i++)
+		scc->sizes[scc->component[i]]++;
+
+	return 0;
+}
+
+static void init_nodes(void *arg, unsigned int begin, unsigned int end)
+{
+	scc_ctx_t *ctx = arg;
+
+	for (unsigned int i = begin; i < end; i++) {
+		ctx->rep[i] = SCC_ACTIVE;
+		ctx->active[i] = i;
+		ctx->mark[i] = 0;
+	}
+}
+
+/*
+ * Strongly connected components, in parallel on tp (serially if tp is
+ * NULL), in three steps. Trimming removes the nodes without an active in-
+ * or out-neighbour, which are components by themselves. A forward and a
+ * backward search from a pivot of high degree then find the component of
+ * the pivot, usually the giant one. Coloring finds the remaining ones.
+ * The searches go over the frontiers in parallel, claiming nodes with
+ * atomic operations.
+ */
+os_scc_t *strongly_connected_components(os_threadpool_t *tp, os_graph_t *graph)
+{
+	unsigned int n = graph->num_nodes, trimmed;
+	size_t size = (size_t) n + 1;
+	os_scc_t *scc;
+	scc_ctx_t ctx;
+	int rc = 0;
+
+	scc = calloc(1, sizeof(*scc));
+	if (scc == NULL) {
+		log_error("Not enough memory");
+		return NULL;
+	}
+	scc->num_nodes = n;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.tp = tp;
+	ctx.graph = graph;
+	ctx.num_active = n;
+	ctx.rep = malloc(size * sizeof(*ctx.rep));
+	ctx.active = malloc(size * sizeof(*ctx.active));
+	ctx.frontier = malloc(size * sizeof(*ctx.frontier));
+	ctx.next = malloc(size * sizeof(*ctx.next));
+	ctx.color = malloc(size * sizeof(*ctx.color));
+	ctx.mark = malloc(size);
+	ctx.partial = malloc((n / SCC_GRAIN + 1) * sizeof(*ctx.partial));
+	scc->component = malloc(size * sizeof(*scc->component));
+	if (ctx.rep == NULL || ctx.active == NULL || ctx.frontier == NULL ||
+	    ctx.next == NULL || ctx.color == NULL || ctx.mark == NULL ||
+	    ctx.partial == NULL || scc->component == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	parallel_for(tp, n, SCC_GRAIN, init_nodes, &ctx);
+
+	for (unsigned int round = 0; round < SCC_TRIM_ROUNDS && ctx.num_active > 0;
+	     round++) {
+		parallel_for(tp, ctx.num_active, SCC_GRAIN, trim_nodes, &ctx);
+		trimmed = sum_partial(&ctx, ctx.num_active);
+		scc->num_trimmed += trimmed;
+		if (trimmed == 0)
+			break;
+		compact_active(&ctx);
+	}
+
+	if (ctx.num_active > 0) {
+		scc->pivot_size = forward_backward(&ctx, choose_pivot(&ctx));
+		compact_active(&ctx);
+	}
+
+	scc->num_colored = color_components(&ctx);
+
+	rc = number_components(&ctx, scc);
+
+out:
+	if (rc < 0) {
+		log_error("Can't compute the components: %s", strerror(-rc));
+		destroy_scc(scc);
+		scc = NULL;
+	}
+
+	free(ctx.rep);
+	free(ctx.active);
+	free(ctx.frontier);
+	free(ctx.next);
+	free(ctx.color);
+	free(ctx.mark);
+	free(ctx.partial);
+
+	return scc;
+}
+
+void destroy_scc(os_scc_t *scc)
+{
+	free(scc->component);
+	free(scc->sizes);
+	free(scc);
+}
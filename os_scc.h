@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_SCC_H__
+#define __OS_SCC_H__	1
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+/*
+ * Strongly connected components of a directed graph, numbered in the order
+ * of their smallest node. An undirected graph gives its connected
+ * components.
+ */
+typedef struct os_scc_t {
+	unsigned int num_nodes;
+	unsigned int num_components;
+
+	// Component of each node, and number of nodes of each component
+	unsigned int *component;
+	unsigned int *sizes;
+
+	// Nodes found by each step: trimming, the pivot search and coloring
+	unsigned int num_trimmed;
+	unsigned int pivot_size;
+	unsigned int num_colored;
+} os_scc_t;
+
+os_scc_t *strongly_connected_components(os_threadpool_t *tp, os_graph_t *graph);
+void destroy_scc(os_scc_t *scc);
+
+#endif
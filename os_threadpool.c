@@ -2,28 +2,90 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sched.h>
+#include <time.h>
 
 #include "os_threadpool.h"
 #include "log/log.h"
 #include "utils.h"
 
+// Worker structure of the calling thread, NULL outside of any pool
+static __thread os_worker_t *current_worker;
+// Group of the task being executed by the calling thread
+static __thread os_task_group_t *current_group;
+
+/* Add to a statistics counter of the calling worker. */
+#define STATS_ADD(w, field, val)					\
+	__atomic_store_n(&(w)->stats.field, (w)->stats.field + (val),	\
+			__ATOMIC_RELAXED)
+
+static unsigned long long clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Lock mutex_queue, accounting the wait to the calling worker. */
+static void lock_queue(os_threadpool_t *tp)
+{
+	os_worker_t *w = current_worker;
+	unsigned long long start;
+
+	if (w == NULL || w->tp != tp) {
+		DIE(pthread_mutex_lock(&tp->mutex_queue) != 0, "pthread_mutex_lock");
+		return;
+	}
+
+	start = clock_ns();
+	DIE(pthread_mutex_lock(&tp->mutex_queue) != 0, "pthread_mutex_lock");
+	STATS_ADD(w, blocked_ns, clock_ns() - start);
+}
+
+/*
+ * Update the number of tasks in the local deques of a worker.
+ * This function should be called with w->lock held.
+ */
+static void update_queue_depth(os_worker_t *w, int delta)
+{
+	w->queue_depth += delta;
+	if (w->queue_depth > w->stats.max_queue_depth)
+		__atomic_store_n(&w->stats.max_queue_depth, w->queue_depth,
+				__ATOMIC_RELAXED);
+}
+
 /* Create a task that would be executed by a thread. */
-os_task_t *create_task(void (*action)(void *), void *arg, void (*destroy_arg)(void *))
+os_task_t *create_task_prio(void (*action)(void *), void *arg, void (*destroy_arg)(void *),
+		os_task_prio_t priority)
 {
 	os_task_t *t;
 
+	assert(priority < OS_TASK_NUM_PRIOS);
+
 	t = malloc(sizeof(*t));
-	DIE(t == NULL, "malloc");
+	if (t == NULL)
+		return NULL;
 
 	t->action = action;		// the function
 	t->argument = arg;		// arguments for the function
 	t->destroy_arg = destroy_arg;	// destroy argument function
+	t->priority = priority;		// priority class
+	t->group = NULL;		// set when the task is enqueued
 
 	return t;
 }
 
+os_task_t *create_task(void (*action)(void *), void *arg, void (*destroy_arg)(void *))
+{
+	return create_task_prio(action, arg, destroy_arg, OS_TASK_PRIO_NORMAL);
+}
+
 /* Destroy task. */
 void destroy_task(os_task_t *t)
 {
@@ -32,95 +94,406 @@ void destroy_task(os_task_t *t)
 	free(t);
 }
 
-/* Put a new task to threadpool task queue. */
+/* Wake up one sleeping worker, if there is any. */
+static void wake_worker(os_threadpool_t *tp)
+{
+	if (__atomic_load_n(&tp->num_sleeping, __ATOMIC_SEQ_CST) == 0)
+		return;
+
+	lock_queue(tp);
+	DIE(pthread_cond_signal(&tp->cond_queue) != 0, "pthread_cond_signal");
+	DIE(pthread_mutex_unlock(&tp->mutex_queue) != 0, "pthread_mutex_unlock");
+}
+
+/*
+ * Put a new task to threadpool task queue.
+ * Workers of the pool push to their own deque, other threads hand the task
+ * to the inbox of a worker, without taking any lock.
+ */
 void enqueue_task(os_threadpool_t *tp, os_task_t *t)
 {
+	os_worker_t *w = current_worker;
+
 	assert(tp != NULL);
 	assert(t != NULL);
 
-	// Lock the queue so that no other thread can access it
-	DIE(pthread_mutex_lock(&tp->mutex_queue) != 0, "pthread_mutex_lock");
+	// Tasks spawned by a task of a group belong to the same group
+	if (t->group == NULL && w != NULL && w->tp == tp)
+		t->group = current_group;
+	if (t->group != NULL)
+		__atomic_add_fetch(&t->group->pending, 1, __ATOMIC_SEQ_CST);
+
+	// Account for the task before it becomes visible to the workers
+	__atomic_add_fetch(&tp->num_pending, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&tp->num_tasks, 1, __ATOMIC_SEQ_CST);
+
+	if (w != NULL && w->tp == tp) {
+		DIE(pthread_mutex_lock(&w->lock) != 0, "pthread_mutex_lock");
+		list_add_tail(&w->deques[t->priority], &t->list);
+		update_queue_depth(w, 1);
+		DIE(pthread_mutex_unlock(&w->lock) != 0, "pthread_mutex_unlock");
+	} else {
+		unsigned int idx;
+
+		idx = __atomic_fetch_add(&tp->next_inbox, 1, __ATOMIC_RELAXED);
+		queue_add(&tp->workers[idx % tp->num_threads].inbox, &t->list);
+	}
 
-	tp->num_tasks++;
+	wake_worker(tp);
+}
 
-	// Add the task to the queue
-	tp->head.prev->next = &t->list;
-	t->list.prev = tp->head.prev;
-	t->list.next = &tp->head;
-	tp->head.prev = &t->list;
+/*
+ * Move tasks received from outside of the pool to the local deques.
+ * This function should be called with w->lock held.
+ */
+static void drain_inbox(os_worker_t *w)
+{
+	os_list_node_t *n;
 
-	// Signal the threads that there is a new task
-	DIE(pthread_cond_broadcast(&tp->cond_queue) != 0, "pthread_cond_broad");
+	while ((n = queue_get(&w->inbox)) != NULL) {
+		os_task_t *t = list_entry(n, os_task_t, list);
 
-	// Unlock the queue
-	DIE(pthread_mutex_unlock(&tp->mutex_queue) != 0, "pthread_mutex_unlock");
+		list_add_tail(&w->deques[t->priority], &t->list);
+		update_queue_depth(w, 1);
+	}
 }
 
 /*
- * Check if queue is empty.
+ * Take a task of the given priority from a worker.
+ * The owner takes the newest task, thieves take the oldest one.
+ */
+static os_task_t *take_task(os_worker_t *w, os_task_prio_t prio, bool steal)
+{
+	os_list_node_t *n = NULL;
+
+	DIE(pthread_mutex_lock(&w->lock) != 0, "pthread_mutex_lock");
+
+	drain_inbox(w);
+	if (!list_empty(&w->deques[prio])) {
+		n = steal ? w->deques[prio].next : w->deques[prio].prev;
+		list_del(n);
+		update_queue_depth(w, -1);
+	}
+
+	DIE(pthread_mutex_unlock(&w->lock) != 0, "pthread_mutex_unlock");
+
+	if (n == NULL)
+		return NULL;
+
+	__atomic_sub_fetch(&w->tp->num_tasks, 1, __ATOMIC_SEQ_CST);
+
+	return list_entry(n, os_task_t, list);
+}
+
+/*
+ * Look for the most urgent task available to a worker.
+ * For every priority class, the local deque is checked first, then the
+ * deques of the other workers, so a high priority task anywhere in the
+ * pool is preferred to a local task of a lower priority.
+ */
+static os_task_t *find_task(os_worker_t *w)
+{
+	os_threadpool_t *tp = w->tp;
+	os_task_t *t;
+	unsigned int attempts = 0;
+
+	for (unsigned int prio = 0; prio < OS_TASK_NUM_PRIOS; prio++) {
+		t = take_task(w, prio, false);
+		if (t != NULL)
+			return t;
+
+		for (unsigned int i = 1; i < tp->num_threads; i++) {
+			os_worker_t *victim = &tp->workers[(w->id + i) % tp->num_threads];
+
+			attempts++;
+			t = take_task(victim, prio, true);
+			if (t != NULL) {
+				STATS_ADD(w, steal_attempts, attempts);
+				STATS_ADD(w, tasks_stolen, 1);
+				return t;
+			}
+		}
+	}
+
+	STATS_ADD(w, steal_attempts, attempts);
+
+	return NULL;
+}
+
+/*
+ * Check if all the work is done.
  * This function should be called in a synchronized manner.
  */
-static int queue_is_empty(os_threadpool_t *tp)
+static bool work_is_done(os_threadpool_t *tp)
 {
-	return list_empty(&tp->head);
+	return tp->finished &&
+		__atomic_load_n(&tp->num_pending, __ATOMIC_SEQ_CST) == 0;
 }
 
 /*
- * Get a task from threadpool task queue.
+ * Get a task for the calling worker.
  * Block if no task is available.
  * Return NULL if work is complete, i.e. no task will become available,
  * i.e. all threads are going to block.
+ * This function must be called by a worker thread of the pool.
  */
-
 os_task_t *dequeue_task(os_threadpool_t *tp)
 {
+	os_worker_t *w = current_worker;
 	os_task_t *t;
+	unsigned long long start;
+	bool done;
 
-	// Lock the queue so that no other thread can access it
-	DIE(pthread_mutex_lock(&tp->mutex_queue) != 0, "pthread_mutex_lock");
+	assert(w != NULL && w->tp == tp);
 
-	// Wait for a task to be added to the queue
-	while (queue_is_empty(tp) && !tp->finished)
-		DIE(pthread_cond_wait(&tp->cond_queue, &tp->mutex_queue) != 0,
-			"pthread_cond_wait");
+	while (1) {
+		t = find_task(w);
+		if (t != NULL)
+			return t;
 
-	// If the queue is empty and the work is done, return NULL
-	if (tp->num_tasks <= 0) {
-		DIE(pthread_mutex_unlock(&tp->mutex_queue) != 0,
-			"pthread_mutex_unlock");
-		return NULL;
-	}
+		lock_queue(tp);
+		start = clock_ns();
+
+		// Announce the sleep before checking for tasks, see wake_worker()
+		__atomic_add_fetch(&tp->num_sleeping, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&tp->num_tasks, __ATOMIC_SEQ_CST) == 0 &&
+				!work_is_done(tp))
+			DIE(pthread_cond_wait(&tp->cond_queue, &tp->mutex_queue) != 0,
+				"pthread_cond_wait");
+		__atomic_sub_fetch(&tp->num_sleeping, 1, __ATOMIC_SEQ_CST);
 
-	tp->num_tasks--;
+		done = work_is_done(tp);
 
-	// Get the first task from the queue and remove it
-	t = list_entry(tp->head.prev, os_task_t, list);
-	list_del(tp->head.prev);
+		DIE(pthread_mutex_unlock(&tp->mutex_queue) != 0, "pthread_mutex_unlock");
+		STATS_ADD(w, idle_ns, clock_ns() - start);
 
-	// Unlock the queue
+		// If no task is queued and the work is done, return NULL
+		if (done)
+			return NULL;
+	}
+}
+
+/* Mark a dequeued task as completed and wake everyone on the last one. */
+static void complete_task(os_threadpool_t *tp)
+{
+	if (__atomic_sub_fetch(&tp->num_pending, 1, __ATOMIC_SEQ_CST) != 0)
+		return;
+
+	lock_queue(tp);
+	DIE(pthread_cond_broadcast(&tp->cond_queue) != 0, "pthread_cond_broadcast");
 	DIE(pthread_mutex_unlock(&tp->mutex_queue) != 0, "pthread_mutex_unlock");
+}
 
-	return t;
+/* Drop a reference to a group, waking up its waiter on the last one. */
+static void task_group_put(os_task_group_t *group)
+{
+	if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST) != 0)
+		return;
+
+	DIE(pthread_mutex_lock(&group->mutex) != 0, "pthread_mutex_lock");
+	group->done = true;
+	DIE(pthread_cond_broadcast(&group->cond) != 0, "pthread_cond_broadcast");
+	DIE(pthread_mutex_unlock(&group->mutex) != 0, "pthread_mutex_unlock");
+}
+
+/* Execute a dequeued task on the calling worker. */
+static void run_task(os_worker_t *w, os_task_t *t)
+{
+	os_task_group_t *group = t->group, *outer = current_group;
+	unsigned long long start;
+
+	start = clock_ns();
+	current_group = group;
+	if (group == NULL || !__atomic_load_n(&group->cancelled, __ATOMIC_RELAXED))
+		t->action(t->argument);
+	current_group = outer;
+	destroy_task(t);
+	STATS_ADD(w, busy_ns, clock_ns() - start);
+	STATS_ADD(w, tasks_executed, 1);
+
+	if (group != NULL)
+		task_group_put(group);
+	complete_task(w->tp);
 }
 
 /* Loop function for threads */
 static void *thread_loop_function(void *arg)
 {
-	os_threadpool_t *tp = (os_threadpool_t *) arg;
+	os_worker_t *w = (os_worker_t *) arg;
+
+	current_worker = w;
 
 	while (1) {
 		os_task_t *t;
 
-		t = dequeue_task(tp);
+		t = dequeue_task(w->tp);
 		if (t == NULL)
 			break;
-		t->action(t->argument);
-		destroy_task(t);
+		run_task(w, t);
 	}
 
+	current_worker = NULL;
+
 	return NULL;
 }
 
+void task_group_init(os_task_group_t *group)
+{
+	group->pending = 1;
+	group->done = false;
+	group->cancelled = false;
+	pthread_mutex_init(&group->mutex, NULL);
+	pthread_cond_init(&group->cond, NULL);
+}
+
+void task_group_destroy(os_task_group_t *group)
+{
+	pthread_mutex_destroy(&group->mutex);
+	pthread_cond_destroy(&group->cond);
+}
+
+/* Put a new task to the threadpool, as part of a group. */
+void enqueue_group_task(os_threadpool_t *tp, os_task_group_t *group, os_task_t *t)
+{
+	t->group = group;
+	enqueue_task(tp, t);
+}
+
+/*
+ * Wait until all the tasks of a group are completed. A group can only be
+ * waited for once. When called from a worker of the pool, the worker
+ * keeps executing tasks while waiting, so nested waits cannot starve the
+ * pool.
+ */
+void task_group_wait(os_threadpool_t *tp, os_task_group_t *group)
+{
+	os_worker_t *w = current_worker;
+
+	// Drop the reference of the waiter, nothing to wait for if it was the last
+	if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST) == 0)
+		return;
+
+	if (w != NULL && w->tp == tp) {
+		while (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) != 0) {
+			os_task_t *t = find_task(w);
+
+			if (t != NULL)
+				run_task(w, t);
+			else
+				sched_yield();
+		}
+	}
+
+	// The last task may still be signalling the group, wait for it
+	DIE(pthread_mutex_lock(&group->mutex) != 0, "pthread_mutex_lock");
+	while (!group->done)
+		DIE(pthread_cond_wait(&group->cond, &group->mutex) != 0, "pthread_cond_wait");
+	DIE(pthread_mutex_unlock(&group->mutex) != 0, "pthread_mutex_unlock");
+}
+
+/*
+ * Cancel a group: its queued tasks are removed from the pool at once and
+ * destroyed without being executed; tasks of the group enqueued or
+ * dequeued later are discarded as well. Tasks already running are not
+ * interrupted. Return the number of removed tasks.
+ */
+unsigned int task_group_cancel(os_threadpool_t *tp, os_task_group_t *group)
+{
+	os_list_node_t dropped, *n, *p;
+	unsigned int count = 0;
+
+	__atomic_store_n(&group->cancelled, true, __ATOMIC_RELEASE);
+
+	list_init(&dropped);
+	for (unsigned int i = 0; i < tp->num_threads; i++) {
+		os_worker_t *w = &tp->workers[i];
+
+		DIE(pthread_mutex_lock(&w->lock) != 0, "pthread_mutex_lock");
+		drain_inbox(w);
+		for (unsigned int prio = 0; prio < OS_TASK_NUM_PRIOS; prio++) {
+			list_for_each_safe(n, p, &w->deques[prio]) {
+				if (list_entry(n, os_task_t, list)->group != group)
+					continue;
+				list_del(n);
+				list_add_tail(&dropped, n);
+				update_queue_depth(w, -1);
+				count++;
+			}
+		}
+		DIE(pthread_mutex_unlock(&w->lock) != 0, "pthread_mutex_unlock");
+	}
+
+	// Complete the removed tasks outside of the worker locks
+	list_for_each_safe(n, p, &dropped) {
+		list_del(n);
+		destroy_task(list_entry(n, os_task_t, list));
+		__atomic_sub_fetch(&tp->num_tasks, 1, __ATOMIC_SEQ_CST);
+		task_group_put(group);
+		complete_task(tp);
+	}
+
+	return count;
+}
+
+typedef struct {
+	void (*fn)(void *arg, unsigned int begin, unsigned int end);
+	void *arg;
+	unsigned int begin, end;
+} chunk_arg_t;
+
+static void run_chunk(void *arg)
+{
+	chunk_arg_t *chunk = arg;
+
+	chunk->fn(chunk->arg, chunk->begin, chunk->end);
+}
+
+/*
+ * Call fn on consecutive ranges of at most grain items covering [0, n),
+ * in parallel on the pool, and wait for all of them. When tp is NULL or
+ * memory is short, the ranges are processed by the calling thread.
+ */
+void parallel_for(os_threadpool_t *tp, unsigned int n, unsigned int grain,
+		void (*fn)(void *arg, unsigned int begin, unsigned int end), void *arg)
+{
+	unsigned int num_chunks, i;
+	chunk_arg_t *chunks = NULL;
+	os_task_group_t group;
+
+	if (grain == 0)
+		grain = 1;
+	num_chunks = n / grain + (n % grain != 0);
+
+	if (tp != NULL && num_chunks > 1)
+		chunks = malloc(num_chunks * sizeof(*chunks));
+	if (chunks == NULL) {
+		for (unsigned int begin = 0; begin < n; begin += grain)
+			fn(arg, begin, n - begin < grain ? n : begin + grain);
+		return;
+	}
+
+	task_group_init(&group);
+
+	for (i = 0; i < num_chunks; i++) {
+		os_task_t *t;
+
+		chunks[i].fn = fn;
+		chunks[i].arg = arg;
+		chunks[i].begin = i * grain;
+		chunks[i].end = n - chunks[i].begin < grain ? n : chunks[i].begin + grain;
+
+		t = create_task(run_chunk, &chunks[i], NULL);
+		if (t == NULL)
+			run_chunk(&chunks[i]);
+		else
+			enqueue_group_task(tp, &group, t);
+	}
+
+	task_group_wait(tp, &group);
+	task_group_destroy(&group);
+	free(chunks);
+}
+
 /* Wait completion of all threads. This is to be called by the main thread. */
 void wait_for_completion(os_threadpool_t *tp)
 {
@@ -139,29 +512,118 @@ void wait_for_completion(os_threadpool_t *tp)
 		DIE(pthread_join(tp->threads[i], NULL) != 0, "pthread_join");
 }
 
-/* Create a new threadpool. */
+/*
+ * Take a snapshot of the runtime counters without stopping the workers.
+ * Per-worker values are stored in workers (num_threads entries) and the
+ * aggregated ones in total; either of them may be NULL.
+ */
+void threadpool_get_stats(os_threadpool_t *tp, os_threadpool_stats_t *workers,
+		os_threadpool_stats_t *total)
+{
+	if (total != NULL)
+		memset(total, 0, sizeof(*total));
+
+	for (unsigned int i = 0; i < tp->num_threads; i++) {
+		os_threadpool_stats_t *src = &tp->workers[i].stats;
+		os_threadpool_stats_t s;
+
+		s.tasks_executed = __atomic_load_n(&src->tasks_executed, __ATOMIC_RELAXED);
+		s.tasks_stolen = __atomic_load_n(&src->tasks_stolen, __ATOMIC_RELAXED);
+		s.steal_attempts = __atomic_load_n(&src->steal_attempts, __ATOMIC_RELAXED);
+		s.busy_ns = __atomic_load_n(&src->busy_ns, __ATOMIC_RELAXED);
+		s.idle_ns = __atomic_load_n(&src->idle_ns, __ATOMIC_RELAXED);
+		s.blocked_ns = __atomic_load_n(&src->blocked_ns, __ATOMIC_RELAXED);
+		s.max_queue_depth = __atomic_load_n(&src->max_queue_depth, __ATOMIC_RELAXED);
+
+		if (workers != NULL)
+			workers[i] = s;
+
+		if (total != NULL) {
+			total->tasks_executed += s.tasks_executed;
+			total->tasks_stolen += s.tasks_stolen;
+			total->steal_attempts += s.steal_attempts;
+			total->busy_ns += s.busy_ns;
+			total->idle_ns += s.idle_ns;
+			total->blocked_ns += s.blocked_ns;
+			if (s.max_queue_depth > total->max_queue_depth)
+				total->max_queue_depth = s.max_queue_depth;
+		}
+	}
+}
+
+/*
+ * Return the index of the calling thread among the workers of tp, -1 if it
+ * is not one of them. Parallel loops use it to give each worker its own
+ * scratch state, in tp->num_threads + 1 slots, the last one for other
+ * threads. The state must not be kept across a wait for other tasks,
+ * which may run on the same worker meanwhile.
+ */
+int threadpool_worker_index(os_threadpool_t *tp)
+{
+	os_worker_t *w = current_worker;
+
+	if (w == NULL || w->tp != tp)
+		return -1;
+
+	return w->id;
+}
+
+/* Create a new threadpool. Return NULL, with errno set, on failure. */
 os_threadpool_t *create_threadpool(unsigned int num_threads)
 {
 	os_threadpool_t *tp = NULL;
 	int rc;
 
-	tp = malloc(sizeof(*tp));
-	DIE(tp == NULL, "malloc");
+	assert(num_threads > 0);
 
-	list_init(&tp->head);
+	tp = malloc(sizeof(*tp));
+	if (tp == NULL)
+		return NULL;
 
 	// Initialize the synchronization data
 	pthread_mutex_init(&tp->mutex_queue, NULL);
 	pthread_cond_init(&tp->cond_queue, NULL);
 	tp->num_tasks = 0;
+	tp->num_pending = 0;
+	tp->num_sleeping = 0;
+	tp->next_inbox = 0;
 	tp->finished = false;
 
 	tp->num_threads = num_threads;
+	tp->workers = malloc(num_threads * sizeof(*tp->workers));
 	tp->threads = malloc(num_threads * sizeof(*tp->threads));
-	DIE(tp->threads == NULL, "malloc");
+	if (tp->workers == NULL || tp->threads == NULL) {
+		free(tp->workers);
+		free(tp->threads);
+		free(tp);
+		return NULL;
+	}
+
 	for (unsigned int i = 0; i < num_threads; ++i) {
-		rc = pthread_create(&tp->threads[i], NULL, &thread_loop_function, (void *) tp);
-		DIE(rc < 0, "pthread_create");
+		os_worker_t *w = &tp->workers[i];
+
+		w->tp = tp;
+		w->id = i;
+		pthread_mutex_init(&w->lock, NULL);
+		for (unsigned int prio = 0; prio < OS_TASK_NUM_PRIOS; prio++)
+			list_init(&w->deques[prio]);
+		queue_init(&w->inbox);
+		w->queue_depth = 0;
+		memset(&w->stats, 0, sizeof(w->stats));
+	}
+
+	for (unsigned int i = 0; i < num_threads; ++i) {
+		rc = pthread_create(&tp->threads[i], NULL, &thread_loop_function,
+				(void *) &tp->workers[i]);
+		if (rc != 0) {
+			// Stop the threads created so far; the others never look at tp
+			tp->num_threads = i;
+			wait_for_completion(tp);
+			tp->num_threads = num_threads;
+			destroy_threadpool(tp);
+			errno = rc;
+			return NULL;
+		}
 	}
 
 	return tp;
@@ -176,11 +638,20 @@ void destroy_threadpool(os_threadpool_t *tp)
 	pthread_mutex_destroy(&tp->mutex_queue);
 	pthread_cond_destroy(&tp->cond_queue);
 
-	list_for_each_safe(n, p, &tp->head) {
-		list_del(n);
-		destroy_task(list_entry(n, os_task_t, list));
+	for (unsigned int i = 0; i < tp->num_threads; i++) {
+		os_worker_t *w = &tp->workers[i];
+
+		drain_inbox(w);
+		for (unsigned int prio = 0; prio < OS_TASK_NUM_PRIOS; prio++) {
+			list_for_each_safe(n, p, &w->deques[prio]) {
+				list_del(n);
+				destroy_task(list_entry(n, os_task_t, list));
+			}
+		}
+		pthread_mutex_destroy(&w->lock);
 	}
 
+	free(tp->workers);
 	free(tp->threads);
 	free(tp);
 }
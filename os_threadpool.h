@@ -7,31 +7,98 @@
 #include <stdbool.h>
 #include <pthread.h>
 
+/* Task priority classes, from the most to the least urgent. */
+typedef enum {
+	OS_TASK_PRIO_HIGH = 0,
+	OS_TASK_PRIO_NORMAL,
+	OS_TASK_PRIO_LOW,
+	OS_TASK_NUM_PRIOS
+} os_task_prio_t;
+
+/*
+ * Set of tasks that can be waited for without stopping the pool, e.g. all
+ * the tasks of one query. Tasks enqueued by a task of a group join the
+ * same group.
+ */
+typedef struct os_task_group_t {
+	// Tasks not completed yet, plus one reference dropped by the waiter
+	unsigned int pending;
+	bool done;
+
+	// Set by task_group_cancel(), tasks of the group are then discarded
+	bool cancelled;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} os_task_group_t;
+
 typedef struct {
 	void *argument;
 	void (*action)(void *arg);
 	void (*destroy_arg)(void *arg);
+	os_task_prio_t priority;
+	os_task_group_t *group;
 	os_list_node_t list;
 } os_task_t;
 
+struct os_threadpool;
+
+/*
+ * Runtime counters of a worker. Times are in nanoseconds.
+ * Each field is only written by its worker (or under its lock for the
+ * queue depth) and can be read at any time with relaxed atomic loads.
+ */
+typedef struct os_threadpool_stats_t {
+	unsigned long long tasks_executed;
+	unsigned long long tasks_stolen;
+	unsigned long long steal_attempts;
+	unsigned long long busy_ns;		// running tasks
+	unsigned long long idle_ns;		// waiting for new tasks
+	unsigned long long blocked_ns;		// waiting to acquire mutex_queue
+	unsigned int max_queue_depth;		// high-water mark of the local deques
+} os_threadpool_stats_t;
+
+typedef struct os_worker_t {
+	struct os_threadpool *tp;
+	unsigned int id;
+
+	// Mutex protecting the local deques and the consumer side of the inbox
+	pthread_mutex_t lock;
+
+	/*
+	 * Local deques, one per priority class.
+	 * The owner pushes and pops at the back (head.prev), thieves steal
+	 * from the front (head.next).
+	 */
+	os_list_node_t deques[OS_TASK_NUM_PRIOS];
+
+	// Tasks submitted by threads outside of the pool
+	os_queue_t inbox;
+
+	// Number of tasks in the local deques, protected by lock
+	unsigned int queue_depth;
+
+	os_threadpool_stats_t stats;
+} os_worker_t;
+
 typedef struct os_threadpool {
 	unsigned int num_threads;
 	pthread_t *threads;
+	os_worker_t *workers;
+
+	// Number of tasks waiting in a deque or an inbox
 	unsigned int num_tasks;
+	// Number of tasks enqueued but not yet executed to completion
+	unsigned int num_pending;
+	// Number of workers sleeping on cond_queue
+	unsigned int num_sleeping;
+	// Round robin cursor used to spread outside submissions
+	unsigned int next_inbox;
 
 	// Flag to check if the threadpool is finished
 	bool finished;
 
-	/*
-	 * Head of queue used to store tasks.
-	 * First item is head.next, if head.next != head (i.e. if queue
-	 * is not empty).
-	 * Last item is head.prev, if head.prev != head (i.e. if queue
-	 * is not empty).
-	 */
-	os_list_node_t head;
-
-	// Mutex used to synchronize access to the queue
+	// Mutex used by idle workers to wait for new tasks
 	pthread_mutex_t mutex_queue;
 
 	// Condition variable used to signal the threads
@@ -40,6 +107,8 @@ typedef struct os_threadpool {
 } os_threadpool_t;
 
 os_task_t *create_task(void (*f)(void *), void *arg, void (*destroy_arg)(void *));
+os_task_t *create_task_prio(void (*f)(void *), void *arg, void (*destroy_arg)(void *),
+		os_task_prio_t priority);
 void destroy_task(os_task_t *t);
 
 os_threadpool_t *create_threadpool(unsigned int num_threads);
@@ -49,4 +118,17 @@ void enqueue_task(os_threadpool_t *q, os_task_t *t);
 os_task_t *dequeue_task(os_threadpool_t *tp);
 void wait_for_completion(os_threadpool_t *tp);
 
+void task_group_init(os_task_group_t *group);
+void task_group_destroy(os_task_group_t *group);
+void enqueue_group_task(os_threadpool_t *tp, os_task_group_t *group, os_task_t *t);
+void task_group_wait(os_threadpool_t *tp, os_task_group_t *group);
+unsigned int task_group_cancel(os_threadpool_t *tp, os_task_group_t *group);
+
+void parallel_for(os_threadpool_t *tp, unsigned int n, unsigned int grain,
+		void (*fn)(void *arg, unsigned int begin, unsigned int end), void *arg);
+
+void threadpool_get_stats(os_threadpool_t *tp, os_threadpool_stats_t *workers,
+		os_threadpool_stats_t *total);
+int threadpool_worker_index(os_threadpool_t *tp);
+
 #endif
@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "os_topo.h"
+#include "log/log.h"
+
+#define TOPO_GRAIN		1024
+
+typedef struct {
+	os_threadpool_t *tp;
+	os_graph_t *graph;
+	os_topo_t *topo;
+
+	// In-neighbours not sorted yet, and largest finish among the sorted ones
+	unsigned int *in_degree;
+	long long *start;
+
+	// Level being released, from order[begin]; order is filled up to tail
+	unsigned int begin, depth, tail;
+
+	// Per task largest finish, and its node
+	long long *partial_max;
+	unsigned int *partial_node;
+} topo_ctx_t;
+
+static void atomic_max64(long long *p, long long v)
+{
+	long long cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+	while (v > cur && !__atomic_compare_exchange_n(p, &cur, v, false,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void push_node(topo_ctx_t *ctx, unsigned int v, unsigned int level)
+{
+	ctx->topo->level[v] = level;
+	ctx->topo->order[__atomic_fetch_add(&ctx->tail, 1, __ATOMIC_RELAXED)] = v;
+}
+
+static void init_nodes(void *arg, unsigned int begin, unsigned int end)
+{
+	topo_ctx_t *ctx = arg;
+
+	for (unsigned int v = begin; v < end; v++) {
+		ctx->in_degree[v] = graph_in_degree(ctx->graph, v);
+		ctx->start[v] = 0;
+		ctx->topo->level[v] = OS_TOPO_CYCLIC;
+		if (ctx->in_degree[v] == 0)
+			push_node(ctx, v, 0);
+	}
+}
+
+/*
+ * Finish the nodes of the current level and pass their finish to their
+ * out-neighbours. The last in-neighbour of a node to do so moves it to the
+ * next level. The finish of every in-neighbour of a node is passed before
+ * the level of the node is released, one parallel loop later.
+ */
+static void release_level(void *arg, unsigned int begin, unsigned int end)
+{
+	topo_ctx_t *ctx = arg;
+	os_graph_t *graph = ctx->graph;
+	os_topo_t *topo = ctx->topo;
+
+	for (unsigned int i = ctx->begin + begin; i < ctx->begin + end; i++) {
+		unsigned int u = topo->order[i], *nb = graph_out_neighbours(graph, u);
+		long long finish = ctx->start[u] + graph->info[u];
+
+		topo->finish[u] = finish;
+		for (unsigned int j = 0; j < graph_out_degree(graph, u); j++) {
+			unsigned int w = nb[j];
+
+			atomic_max64(&ctx->start[w], finish);
+			if (__atomic_sub_fetch(&ctx->in_degree[w], 1, __ATOMIC_RELAXED) == 0)
+				push_node(ctx, w, ctx->depth + 1);
+		}
+	}
+}
+
+static void find_critical(void *arg, unsigned int begin, unsigned int end)
+{
+	topo_ctx_t *ctx = arg;
+	os_topo_t *topo = ctx->topo;
+	unsigned int best = topo->order[begin];
+
+	for (unsigned int i = begin; i < end; i++) {
+		if (topo->finish[topo->order[i]] > topo->finish[best])
+			best = topo->order[i];
+	}
+
+	ctx->partial_max[begin / TOPO_GRAIN] = topo->finish[best];
+	ctx->partial_node[begin / TOPO_GRAIN] = best;
+}
+
+/*
+ * Longest path of the graph: from the node with the largest finish, go back
+ * through the in-neighbours whose finish gave the start of the node.
+ */
+static int critical_path(topo_ctx_t *ctx)
+{
+	os_graph_t *graph = ctx->graph;
+	os_topo_t *topo = ctx->topo;
+	unsigned int num_tasks = (topo->num_sorted + TOPO_GRAIN - 1) / TOPO_GRAIN;
+	unsigned int v, len = 0, *path;
+
+	if (topo->num_sorted == 0)
+		return 0;
+
+	parallel_for(ctx->tp, topo->num_sorted, TOPO_GRAIN, find_critical, ctx);
+	v = ctx->partial_node[0];
+	for (unsigned int c = 1; c < num_tasks; c++) {
+		if (ctx->partial_max[c] > topo->finish[v])
+			v = ctx->partial_node[c];
+	}
+	topo->critical_length = topo->finish[v];
+
+	// A path has at most one node per level
+	path = malloc(topo->num_levels * sizeof(*path));
+	if (path == NULL)
+		return -ENOMEM;
+
+	for (;;) {
+		unsigned int *nb = graph_in_neighbours(graph, v), next = v;
+
+		path[len++] = v;
+		for (unsigned int j = 0; j < graph_in_degree(graph, v); j++) {
+			if (topo->level[nb[j]] != OS_TOPO_CYCLIC &&
+			    topo->finish[nb[j]] == ctx->start[v]) {
+				next = nb[j];
+				break;
+			}
+		}
+		if (next == v)
+			break;
+		v = next;
+	}
+
+	for (unsigned int i = 0; i < len / 2; i++) {
+		unsigned int tmp = path[i];
+
+		path[i] = path[len - 1 - i];
+		path[len - 1 - i] = tmp;
+	}
+	topo->critical_path = path;
+	topo->critical_path_length = len;
+
+	return 0;
+}
+
+/*
+ * Every node left out of the order has an in-neighbour left out too: going
+ * back through them from any of them ends up in a cycle. The free end of the
+ * order holds the nodes of the walk, in_degree their position in it.
+ */
+static int find_cycle(topo_ctx_t *ctx)
+{
+	os_graph_t *graph = ctx->graph;
+	os_topo_t *topo = ctx->topo;
+	unsigned int *walk = topo->order + topo->num_sorted;
+	unsigned int v = 0, steps = 0, first;
+
+	while (topo->level[v] != OS_TOPO_CYCLIC)
+		v++;
+	memset(ctx->in_degree, 0, graph->num_nodes * sizeof(*ctx->in_degree));
+
+	while (ctx->in_degree[v] == 0) {
+		unsigned int *nb = graph_in_neighbours(graph, v);
+		unsigned int j = 0;
+
+		walk[steps++] = v;
+		ctx->in_degree[v] = steps;
+		while (topo->level[nb[j]] != OS_TOPO_CYCLIC)
+			j++;
+		v = nb[j];
+	}
+
+	first = ctx->in_degree[v] - 1;
+	topo->cycle_length = steps - first;
+	topo->cycle = malloc(topo->cycle_length * sizeof(*topo->cycle));
+	if (topo->cycle == NULL)
+		return -ENOMEM;
+
+	// The walk followed the edges backwards
+	for (unsigned int i = 0; i < topo->cycle_length; i++)
+		topo->cycle[i] = walk[steps - 1 - i];
+
+	return 0;
+}
+
+/*
+ * Topological sort by Kahn's algorithm, in parallel on tp (serially if tp
+ * is NULL). Nodes are released level by level: each level is split across
+ * the workers, which count down the in-degrees of the out-neighbours and
+ * pass them the finish of the node with an atomic maximum, so the critical
+ * path is found in the same sweep. If nodes are left out, the graph has a
+ * cycle, which is reported. The graph must be directed.
+ */
+os_topo_t *topological_sort(os_threadpool_t *tp, os_graph_t *graph)
+{
+	unsigned int n = graph->num_nodes, head = 0;
+	size_t size = (size_t) n + 1;
+	os_topo_t *topo;
+	topo_ctx_t ctx;
+	int rc = 0;
+
+	if (graph->out_ends == NULL) {
+		log_error("A topological sort needs a directed graph");
+		return NULL;
+	}
+
+	topo = calloc(1, sizeof(*topo));
+	if (topo == NULL) {
+		log_error("Not enough memory");
+		return NULL;
+	}
+	topo->num_nodes = n;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.tp = tp;
+	ctx.graph = graph;
+	ctx.topo = topo;
+	ctx.in_degree = malloc(size * sizeof(*ctx.in_degree));
+	ctx.start = malloc(size * sizeof(*ctx.start));
+	ctx.partial_max = malloc((n / TOPO_GRAIN + 1) * sizeof(*ctx.partial_max));
+	ctx.partial_node = malloc((n / TOPO_GRAIN + 1) * sizeof(*ctx.partial_node));
+	topo->order = malloc(size * sizeof(*topo->order));
+	topo->level = malloc(size * sizeof(*topo->level));
+	topo->finish = malloc(size * sizeof(*topo->finish));
+	if (ctx.in_degree == NULL || ctx.start == NULL || ctx.partial_max == NULL ||
+	    ctx.partial_node == NULL || topo->order == NULL || topo->level == NULL ||
+	    topo->finish == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	parallel_for(tp, n, TOPO_GRAIN, init_nodes, &ctx);
+
+	while (head < ctx.tail) {
+		unsigned int end = ctx.tail;
+
+		ctx.begin = head;
+		parallel_for(tp, end - head, TOPO_GRAIN, release_level, &ctx);
+		head = end;
+		ctx.depth++;
+	}
+	topo->num_sorted = ctx.tail;
+	topo->num_levels = ctx.depth;
+
+	rc = critical_path(&ctx);
+	if (rc == 0 && topo->num_sorted < n) {
+		topo->cyclic = true;
+		rc = find_cycle(&ctx);
+	}
+
+out:
+	if (rc < 0) {
+		log_error("Can't sort the graph: %s", strerror(-rc));
+		destroy_topo(topo);
+		topo = NULL;
+	}
+
+	free(ctx.in_degree);
+	free(ctx.start);
+	free(ctx.partial_max);
+	free(ctx.partial_node);
+
+	return topo;
+}
+
+void destroy_topo(os_topo_t *topo)
+{
+	free(topo->order);
+	free(topo->level);
+	free(topo->finish);
+	free(topo->critical_path);
+	free(topo->cycle);
+	free(topo);
+}
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_TOPO_H__
+#define __OS_TOPO_H__	1
+
+#include <stdbool.h>
+#include <limits.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+// Level of the nodes left out of the order by a cycle
+#define OS_TOPO_CYCLIC	UINT_MAX
+
+/*
+ * Topological order of a directed graph, with the critical path of the
+ * graph taken as a build: the info of a node is the cost of its task, which
+ * can start once the tasks of its in-neighbours are done.
+ */
+typedef struct os_topo_t {
+	unsigned int num_nodes;
+
+	/*
+	 * The num_sorted first nodes in topological order, by level: the
+	 * nodes of level 0 have no in-neighbour, those of level l + 1 only
+	 * have in-neighbours in the levels up to l, one at least in level l.
+	 */
+	unsigned int *order;
+	unsigned int num_sorted;
+	unsigned int *level;
+	unsigned int num_levels;
+
+	/*
+	 * Largest total cost of a path ending at each node, including the
+	 * node, for the sorted nodes; the largest of them and the nodes of a
+	 * path reaching it, from its first node.
+	 */
+	long long *finish;
+	long long critical_length;
+	unsigned int *critical_path;
+	unsigned int critical_path_length;
+
+	// If the graph is not acyclic, the nodes of one of its cycles, in order
+	bool cyclic;
+	unsigned int *cycle;
+	unsigned int cycle_length;
+} os_topo_t;
+
+os_topo_t *topological_sort(os_threadpool_t *tp, os_graph_t *graph);
+void destroy_topo(os_topo_t *topo);
+
+#endif
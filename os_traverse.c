@@ -0,0 +1,414 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "os_traverse.h"
+#include "os_visited.h"
+
+// Number of nodes a thread processes between two reads of the clock
+#define DEADLINE_CHECK_INTERVAL	64
+#define BFS_GRAIN		256
+#define TREE_GRAIN		(64 * 1024)
+
+typedef struct {
+	os_threadpool_t *tp;
+	os_task_group_t *group;
+	os_graph_t *graph;
+	os_visited_t *visited;
+	const os_query_opts_t *opts;
+	unsigned long long start_ns;
+	unsigned long long deadline_ns;
+
+	long long sum;
+	unsigned int num_visited;
+	int error;
+	bool stopped;
+} os_query_t;
+
+static __thread unsigned int deadline_countdown;
+
+/* Level synchronous search, used when the BFS tree is asked for. */
+typedef struct {
+	os_query_t *query;
+	unsigned int *frontier, *next;
+	unsigned int next_size;
+	unsigned int depth;
+} bfs_t;
+
+typedef struct {
+	os_query_t *query;
+	unsigned int idx;
+} node_arg_t;
+
+static void set_error(os_query_t *query, int error)
+{
+	int expected = 0;
+
+	// Keep the first error
+	__atomic_compare_exchange_n(&query->error, &expected, error, false,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/*
+ * Check if a query must stop, because it was cancelled or went past its
+ * deadline. The first thread noticing it drops all the queued tasks of the
+ * query at once.
+ */
+static bool should_stop(os_query_t *query)
+{
+	os_cancel_token_t *cancel = query->opts->cancel;
+
+	if (__atomic_load_n(&query->stopped, __ATOMIC_RELAXED))
+		return true;
+
+	if (cancel != NULL && __atomic_load_n(&cancel->cancelled, __ATOMIC_ACQUIRE))
+		goto stop;
+
+	if (query->deadline_ns != 0 && deadline_countdown-- == 0) {
+		deadline_countdown = DEADLINE_CHECK_INTERVAL;
+		if (histogram_clock_ns() >= query->deadline_ns)
+			goto stop;
+	}
+
+	return false;
+
+stop:
+	if (!__atomic_exchange_n(&query->stopped, true, __ATOMIC_RELAXED) &&
+	    query->group != NULL)
+		task_group_cancel(query->tp, query->group);
+
+	return true;
+}
+
+static int start_query(os_query_t *query, os_threadpool_t *tp, os_graph_t *graph,
+		unsigned int source, const os_query_opts_t *opts)
+{
+	static const os_query_opts_t default_opts;
+
+	memset(query, 0, sizeof(*query));
+	query->tp = tp;
+	query->graph = graph;
+	query->opts = opts != NULL ? opts : &default_opts;
+	query->start_ns = histogram_clock_ns();
+	if (query->opts->timeout_ns != 0)
+		query->deadline_ns = query->start_ns + query->opts->timeout_ns;
+
+	if (source >= graph->num_nodes)
+		return -EINVAL;
+
+	if (query->opts->visited != NULL) {
+		query->visited = query->opts->visited;
+		visited_reset(query->visited);
+		return 0;
+	}
+
+	query->visited = create_visited(graph->num_nodes);
+	if (query->visited == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int end_query(os_query_t *query, os_query_result_t *result)
+{
+	if (query->visited != query->opts->visited)
+		destroy_visited(query->visited);
+
+	result->error = query->error;
+	result->sum = query->sum;
+	result->num_visited = query->num_visited;
+	result->elapsed_ns = histogram_clock_ns() - query->start_ns;
+	result->truncated = query->stopped;
+
+	if (query->opts->latency != NULL)
+		histogram_record(query->opts->latency, result->elapsed_ns);
+
+	return result->error;
+}
+
+static bool wants_tree(const os_query_opts_t *opts)
+{
+	return opts->parent != NULL || opts->level != NULL;
+}
+
+static void reset_tree(void *arg, unsigned int begin, unsigned int end)
+{
+	const os_query_opts_t *opts = arg;
+
+	for (unsigned int i = begin; i < end; i++) {
+		if (opts->parent != NULL)
+			opts->parent[i] = OS_TRAVERSE_UNREACHED;
+		if (opts->level != NULL)
+			opts->level[i] = OS_TRAVERSE_UNREACHED;
+	}
+}
+
+/*
+ * Claim a node for the search, recording its parent and depth. The parent
+ * array, or the level array without it, holds the claims: only the thread
+ * whose CAS takes the entry from OS_TRAVERSE_UNREACHED gets the node.
+ */
+static bool claim_node(const os_query_opts_t *opts, unsigned int idx,
+		unsigned int parent, unsigned int level)
+{
+	unsigned int *claims = opts->parent != NULL ? opts->parent : opts->level;
+	unsigned int expected = OS_TRAVERSE_UNREACHED;
+
+	if (__atomic_load_n(&claims[idx], __ATOMIC_RELAXED) != expected ||
+	    !__atomic_compare_exchange_n(&claims[idx], &expected,
+			opts->parent != NULL ? parent : level, false,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return false;
+
+	if (opts->parent != NULL && opts->level != NULL)
+		opts->level[idx] = level;
+
+	return true;
+}
+
+/* Add the nodes of frontier[begin, end) and claim their unreached neighbours. */
+static void expand_frontier(void *arg, unsigned int begin, unsigned int end)
+{
+	bfs_t *bfs = arg;
+	os_query_t *query = bfs->query;
+	os_graph_t *graph = query->graph;
+	unsigned int count = 0;
+	long long sum = 0;
+
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int idx = bfs->frontier[i];
+		unsigned int *neighbours = graph_neighbours(graph, idx);
+
+		if (should_stop(query))
+			break;
+
+		sum += graph->info[idx];
+		count++;
+
+		for (unsigned int j = 0; j < graph_degree(graph, idx); j++) {
+			if (claim_node(query->opts, neighbours[j], idx, bfs->depth + 1))
+				bfs->next[__atomic_fetch_add(&bfs->next_size, 1,
+						__ATOMIC_RELAXED)] = neighbours[j];
+		}
+
+		// Expanded, see unclaim_nodes()
+		bfs->frontier[i] = OS_TRAVERSE_UNREACHED;
+	}
+
+	__atomic_add_fetch(&query->sum, sum, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&query->num_visited, count, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drop the nodes of a frontier which were claimed but never expanded from
+ * the tree, so that a stopped search only reports the nodes it summed.
+ */
+static void unclaim_nodes(const os_query_opts_t *opts, const unsigned int *nodes,
+		unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i++) {
+		if (nodes[i] == OS_TRAVERSE_UNREACHED)
+			continue;
+		if (opts->parent != NULL)
+			opts->parent[nodes[i]] = OS_TRAVERSE_UNREACHED;
+		if (opts->level != NULL)
+			opts->level[nodes[i]] = OS_TRAVERSE_UNREACHED;
+	}
+}
+
+/*
+ * Breadth first search filling the BFS tree of the options, one frontier
+ * at a time, each split across the workers of tp (serially if tp is NULL).
+ */
+static int traverse_bfs(os_query_t *query, unsigned int source)
+{
+	os_graph_t *graph = query->graph;
+	unsigned int size = 1, prev_size = 0, *tmp;
+	bfs_t bfs;
+
+	memset(&bfs, 0, sizeof(bfs));
+	bfs.query = query;
+	bfs.frontier = malloc(((size_t) graph->num_nodes + 1) * sizeof(*bfs.frontier));
+	bfs.next = malloc(((size_t) graph->num_nodes + 1) * sizeof(*bfs.next));
+	if (bfs.frontier == NULL || bfs.next == NULL) {
+		free(bfs.frontier);
+		free(bfs.next);
+		return -ENOMEM;
+	}
+
+	parallel_for(query->tp, graph->num_nodes, TREE_GRAIN, reset_tree,
+		     (void *) query->opts);
+	claim_node(query->opts, source, source, 0);
+	bfs.frontier[0] = source;
+
+	while (size > 0 && !query->stopped) {
+		bfs.next_size = 0;
+		parallel_for(query->tp, size, BFS_GRAIN, expand_frontier, &bfs);
+
+		prev_size = size;
+		size = bfs.next_size;
+		tmp = bfs.frontier, bfs.frontier = bfs.next, bfs.next = tmp;
+		bfs.depth++;
+	}
+
+	// The last frontier may be partly expanded, the next one is not at all
+	if (query->stopped) {
+		unclaim_nodes(query->opts, bfs.next, prev_size);
+		unclaim_nodes(query->opts, bfs.frontier, size);
+	}
+
+	free(bfs.frontier);
+	free(bfs.next);
+
+	return 0;
+}
+
+static void serial_process_node(os_query_t *query, unsigned int idx)
+{
+	os_graph_t *graph = query->graph;
+	unsigned int *neighbours;
+	int rc;
+
+	if (should_stop(query))
+		return;
+
+	rc = visited_add(query->visited, idx);
+	if (rc <= 0) {
+		if (rc < 0)
+			set_error(query, rc);
+		return;
+	}
+
+	neighbours = graph_neighbours(graph, idx);
+	query->sum += graph->info[idx];
+	query->num_visited++;
+
+	for (unsigned int i = 0; i < graph_degree(graph, idx); i++)
+		if (!visited_contains(query->visited, neighbours[i]))
+			serial_process_node(query, neighbours[i]);
+}
+
+int traverse_serial(os_graph_t *graph, unsigned int source,
+		const os_query_opts_t *opts, os_query_result_t *result)
+{
+	os_query_t query;
+	int rc;
+
+	rc = start_query(&query, NULL, graph, source, opts);
+	if (rc < 0) {
+		memset(result, 0, sizeof(*result));
+		result->error = rc;
+		return rc;
+	}
+
+	if (wants_tree(query.opts)) {
+		rc = traverse_bfs(&query, source);
+		if (rc < 0)
+			set_error(&query, rc);
+	} else {
+		serial_process_node(&query, source);
+	}
+
+	return end_query(&query, result);
+}
+
+static void process_node(void *arg);
+
+/* Create the task processing a node; it joins the group of the caller. */
+static int spawn_node(os_query_t *query, os_task_group_t *group, unsigned int idx)
+{
+	node_arg_t *node_arg;
+	os_task_t *t;
+
+	node_arg = malloc(sizeof(*node_arg));
+	if (node_arg == NULL)
+		return -ENOMEM;
+	node_arg->query = query;
+	node_arg->idx = idx;
+
+	t = create_task(process_node, node_arg, free);
+	if (t == NULL) {
+		free(node_arg);
+		return -ENOMEM;
+	}
+
+	if (group != NULL)
+		enqueue_group_task(query->tp, group, t);
+	else
+		enqueue_task(query->tp, t);
+
+	return 0;
+}
+
+static void process_node(void *arg)
+{
+	node_arg_t *node_arg = arg;
+	os_query_t *query = node_arg->query;
+	os_graph_t *graph = query->graph;
+	unsigned int idx = node_arg->idx;
+	unsigned int *neighbours;
+	int rc;
+
+	if (should_stop(query))
+		return;
+
+	// Claim the node, only the first task reaching it processes it
+	rc = visited_add(query->visited, idx);
+	if (rc <= 0) {
+		if (rc < 0)
+			set_error(query, rc);
+		return;
+	}
+
+	neighbours = graph_neighbours(graph, idx);
+
+	__atomic_add_fetch(&query->sum, graph->info[idx], __ATOMIC_RELAXED);
+	__atomic_add_fetch(&query->num_visited, 1, __ATOMIC_RELAXED);
+
+	for (unsigned int i = 0; i < graph_degree(graph, idx); i++) {
+		if (!visited_contains(query->visited, neighbours[i])) {
+			rc = spawn_node(query, NULL, neighbours[i]);
+			if (rc < 0) {
+				set_error(query, rc);
+				return;
+			}
+		}
+	}
+}
+
+int traverse_parallel(os_threadpool_t *tp, os_graph_t *graph, unsigned int source,
+		const os_query_opts_t *opts, os_query_result_t *result)
+{
+	os_task_group_t group;
+	os_query_t query;
+	int rc;
+
+	rc = start_query(&query, tp, graph, source, opts);
+	if (rc < 0) {
+		memset(result, 0, sizeof(*result));
+		result->error = rc;
+		return rc;
+	}
+
+	if (wants_tree(query.opts)) {
+		rc = traverse_bfs(&query, source);
+		if (rc < 0)
+			set_error(&query, rc);
+		return end_query(&query, result);
+	}
+
+	task_group_init(&group);
+	query.group = &group;
+
+	rc = spawn_node(&query, &group, source);
+	if (rc < 0)
+		set_error(&query, rc);
+
+	task_group_wait(tp, &group);
+	task_group_destroy(&group);
+
+	return end_query(&query, result);
+}
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_TRAVERSE_H__
+#define __OS_TRAVERSE_H__	1
+
+#include "os_graph.h"
+#include "os_histogram.h"
+#include "os_threadpool.h"
+#include "os_visited.h"
+
+#include <stdbool.h>
+#include <limits.h>
+
+/* Cancellation token, may be shared by several queries. */
+typedef struct os_cancel_token_t {
+	bool cancelled;
+} os_cancel_token_t;
+
+static inline void cancel_token_init(os_cancel_token_t *token)
+{
+	token->cancelled = false;
+}
+
+/* Ask the queries using the token to stop; safe from any thread. */
+static inline void cancel_token_cancel(os_cancel_token_t *token)
+{
+	__atomic_store_n(&token->cancelled, true, __ATOMIC_RELEASE);
+}
+
+// Entry of the parent and level arrays for the nodes not reached
+#define OS_TRAVERSE_UNREACHED	UINT_MAX
+
+/* Optional settings of a traversal; a NULL pointer selects the defaults. */
+typedef struct os_query_opts_t {
+	// If set, the latency of the traversal is recorded in it, in nanoseconds
+	os_histogram_t *latency;
+
+	// If set, the traversal stops once the token is cancelled
+	os_cancel_token_t *cancel;
+	// If not 0, the traversal stops after running for this long
+	unsigned long long timeout_ns;
+
+	/*
+	 * If either is set, the traversal runs breadth first and fills it with
+	 * the BFS parent, or the depth, of every node it reaches, one entry per
+	 * node of the graph. The source is its own parent. A truncated
+	 * traversal only fills the entries of the nodes it summed.
+	 */
+	unsigned int *parent;
+	unsigned int *level;
+
+	/*
+	 * If set, the visited set of the traversal, reset when it starts,
+	 * instead of one allocated per traversal. Traversals run back to back
+	 * with the same set only pay for the nodes they touch; concurrent
+	 * traversals need a set each.
+	 */
+	os_visited_t *visited;
+} os_query_opts_t;
+
+/* Result of one traversal. */
+typedef struct os_query_result_t {
+	// 0 on success, a negative errno value otherwise
+	int error;
+
+	// Sum of the info of the nodes reachable from the source
+	long long sum;
+	unsigned int num_visited;
+
+	unsigned long long elapsed_ns;
+
+	// The query was cancelled or timed out, sum only covers part of the nodes
+	bool truncated;
+} os_query_result_t;
+
+/*
+ * Traversals keep all their state in the query and the result, so any
+ * number of them can run concurrently on the same graph and pool.
+ * They return result->error.
+ */
+int traverse_serial(os_graph_t *graph, unsigned int source,
+		const os_query_opts_t *opts, os_query_result_t *result);
+int traverse_parallel(os_threadpool_t *tp, os_graph_t *graph, unsigned int source,
+		const os_query_opts_t *opts, os_query_result_t *result);
+
+#endif
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "os_visited.h"
+#include "utils.h"
+
+#define VISITED_MIN_THRESHOLD	64
+#define VISITED_MAX_THRESHOLD	(1U << 16)
+
+static unsigned int slot_of(os_visited_t *set, unsigned int idx)
+{
+	// Fibonacci hashing, keep the high bits of the product
+	return (idx * 2654435769U) >> (32 - set->table_bits);
+}
+
+os_visited_t *create_visited(unsigned int num_nodes)
+{
+	os_visited_t *set;
+	unsigned int threshold;
+
+	set = malloc(sizeof(*set));
+	if (set == NULL)
+		return NULL;
+
+	/*
+	 * Promote once the set holds a noticeable part of the graph, but keep
+	 * the table small enough to stay in cache.
+	 */
+	threshold = num_nodes / 64;
+	if (threshold < VISITED_MIN_THRESHOLD)
+		threshold = VISITED_MIN_THRESHOLD;
+	if (threshold > VISITED_MAX_THRESHOLD)
+		threshold = VISITED_MAX_THRESHOLD;
+
+	set->num_nodes = num_nodes;
+	set->threshold = threshold;
+	set->count = 0;
+	set->stamps = NULL;
+	set->epoch = 1;
+	set->dense = false;
+
+	// At most half full when promoted
+	set->table_bits = 1;
+	while ((1U << set->table_bits) < 2 * threshold)
+		set->table_bits++;
+	set->table = calloc(1U << set->table_bits, sizeof(*set->table));
+	if (set->table == NULL || pthread_rwlock_init(&set->lock, NULL) != 0) {
+		free(set->table);
+		free(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+void destroy_visited(os_visited_t *set)
+{
+	pthread_rwlock_destroy(&set->lock);
+	free(set->stamps);
+	free(set->table);
+	free(set);
+}
+
+/*
+ * Empty the set. The sparse table is cleared if it was used, the dense
+ * stamps only when the epoch wraps around. Must not run concurrently with
+ * any other call on the set.
+ */
+void visited_reset(os_visited_t *set)
+{
+	if (set->count > 0)
+		memset(set->table, 0, (1UL << set->table_bits) * sizeof(*set->table));
+	set->count = 0;
+	set->dense = false;
+
+	set->epoch++;
+	if (set->epoch == 0) {
+		if (set->stamps != NULL)
+			memset(set->stamps, 0, (size_t) set->num_nodes * sizeof(*set->stamps));
+		set->epoch = 1;
+	}
+}
+
+static int stamp_add(os_visited_t *set, unsigned int idx)
+{
+	unsigned int stamp = __atomic_load_n(&set->stamps[idx], __ATOMIC_RELAXED);
+
+	// Within a traversal, a stamp can only change to the current epoch
+	if (stamp == set->epoch)
+		return 0;
+
+	return __atomic_compare_exchange_n(&set->stamps[idx], &stamp, set->epoch,
+			false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+static int stamp_contains(os_visited_t *set, unsigned int idx)
+{
+	return __atomic_load_n(&set->stamps[idx], __ATOMIC_RELAXED) == set->epoch;
+}
+
+/*
+ * Insert a node in the hash table.
+ * Return 1 if it was added, 0 if it was present and -1 if the table is full.
+ * This function should be called with set->lock held for reading.
+ */
+static int table_add(os_visited_t *set, unsigned int idx)
+{
+	unsigned int mask = (1U << set->table_bits) - 1;
+	unsigned int key = idx + 1;
+	unsigned int slot = slot_of(set, idx);
+
+	for (unsigned int probe = 0; probe <= mask; probe++, slot = (slot + 1) & mask) {
+		unsigned int cur = __atomic_load_n(&set->table[slot], __ATOMIC_RELAXED);
+
+		if (cur == 0 &&
+		    __atomic_compare_exchange_n(&set->table[slot], &cur, key, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			__atomic_add_fetch(&set->count, 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+
+		// Either the slot was taken or another thread just filled it
+		if (cur == key)
+			return 0;
+	}
+
+	return -1;
+}
+
+/* Switch the set to dense stamps, copying the sparse members. */
+static int promote(os_visited_t *set)
+{
+	int rc = 0;
+
+	DIE(pthread_rwlock_wrlock(&set->lock) != 0, "pthread_rwlock_wrlock");
+
+	if (!set->dense) {
+		if (set->stamps == NULL) {
+			set->stamps = calloc((size_t) set->num_nodes + 1, sizeof(*set->stamps));
+			if (set->stamps == NULL) {
+				rc = -ENOMEM;
+				goto out;
+			}
+		}
+
+		for (unsigned int i = 0; i < (1U << set->table_bits); i++)
+			if (set->table[i] != 0)
+				set->stamps[set->table[i] - 1] = set->epoch;
+
+		__atomic_store_n(&set->dense, true, __ATOMIC_RELEASE);
+	}
+
+out:
+	DIE(pthread_rwlock_unlock(&set->lock) != 0, "pthread_rwlock_unlock");
+
+	return rc;
+}
+
+/*
+ * Mark a node as visited. Return 1 if it was not visited before, 0 if it
+ * was and -ENOMEM if the set could not grow to hold it.
+ */
+int visited_add(os_visited_t *set, unsigned int idx)
+{
+	int rc = -1;
+
+	if (__atomic_load_n(&set->dense, __ATOMIC_ACQUIRE))
+		return stamp_add(set, idx);
+
+	DIE(pthread_rwlock_rdlock(&set->lock) != 0, "pthread_rwlock_rdlock");
+
+	// The set may have been promoted while waiting for the lock
+	if (!set->dense &&
+	    __atomic_load_n(&set->count, __ATOMIC_RELAXED) < set->threshold)
+		rc = table_add(set, idx);
+
+	DIE(pthread_rwlock_unlock(&set->lock) != 0, "pthread_rwlock_unlock");
+
+	if (rc >= 0)
+		return rc;
+
+	rc = promote(set);
+	if (rc < 0)
+		return rc;
+
+	return stamp_add(set, idx);
+}
+
+/*
+ * Check if a node is visited.
+ * While other threads insert, the answer is only a hint: use the return
+ * value of visited_add() to decide which thread owns a node.
+ */
+int visited_contains(os_visited_t *set, unsigned int idx)
+{
+	unsigned int mask, key, slot;
+
+	if (__atomic_load_n(&set->dense, __ATOMIC_ACQUIRE))
+		return stamp_contains(set, idx);
+
+	mask = (1U << set->table_bits) - 1;
+	key = idx + 1;
+	slot = slot_of(set, idx);
+	for (unsigned int probe = 0; probe <= mask; probe++, slot = (slot + 1) & mask) {
+		unsigned int cur = __atomic_load_n(&set->table[slot], __ATOMIC_RELAXED);
+
+		if (cur == key)
+			return 1;
+		if (cur == 0)
+			return 0;
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __OS_VISITED_H__
+#define __OS_VISITED_H__	1
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+ * Set of visited nodes for one traversal.
+ * It starts as a small open addressing hash table, so that traversals
+ * touching a few nodes of a huge graph do not pay for a full array, and
+ * is promoted to a dense array of per-node stamps once it holds threshold
+ * nodes. visited_add() and visited_contains() may be called concurrently.
+ * visited_reset() empties the set for the next traversal without freeing
+ * it, so a caller running traversals back to back pays only for the nodes
+ * each one touches.
+ */
+typedef struct os_visited_t {
+	unsigned int num_nodes;
+	unsigned int threshold;
+
+	// Sparse mode: node index + 1 per slot, 0 marks an empty slot
+	unsigned int *table;
+	unsigned int table_bits;
+	unsigned int count;
+
+	/*
+	 * Dense mode: a node is in the set if its stamp is equal to epoch.
+	 * The stamps are allocated by the first promotion and kept across
+	 * resets, which only bump the epoch; they are cleared when it wraps.
+	 */
+	unsigned int *stamps;
+	unsigned int epoch;
+	bool dense;
+
+	// Held for reading by sparse inserts, for writing by the promotion
+	pthread_rwlock_t lock;
+} os_visited_t;
+
+os_visited_t *create_visited(unsigned int num_nodes);
+void destroy_visited(os_visited_t *set);
+void visited_reset(os_visited_t *set);
+int visited_add(os_visited_t *set, unsigned int idx);
+int visited_contains(os_visited_t *set, unsigned int idx);
+
+#endif
@@ -2,105 +2,788 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/random.h>
 #include <time.h>
+#include <math.h>
 
+#include "os_anf.h"
+#include "os_betweenness.h"
+#include "os_biconnected.h"
+#include "os_communities.h"
+#include "os_components.h"
+#include "os_export.h"
 #include "os_graph.h"
+#include "os_graph_image.h"
+#include "os_graph_load.h"
+#include "os_histogram.h"
+#include "os_path.h"
+#include "os_scc.h"
 #include "os_threadpool.h"
+#include "os_topo.h"
+#include "os_traverse.h"
 #include "log/log.h"
 #include "utils.h"
 
 #define NUM_THREADS		4
 
-static int sum;
-static os_graph_t *graph;
-static os_threadpool_t *tp;
-
 typedef unsigned int uint;
 
-// Mutex used to synchronize access to the graph
-pthread_mutex_t mutex_graph;
+enum {
+	ALGO_TRAVERSE,
+	ALGO_CC_STREAM,
+	ALGO_PATH,
+	ALGO_ANF,
+	ALGO_LPA,
+	ALGO_BETWEENNESS,
+	ALGO_SCC,
+	ALGO_BCC,
+	ALGO_TOPO,
+};
+
+static const char * const algo_names[] = {
+	[ALGO_TRAVERSE] = "traverse",
+	[ALGO_CC_STREAM] = "cc-stream",
+	[ALGO_PATH] = "path",
+	[ALGO_ANF] = "anf",
+	[ALGO_LPA] = "lpa",
+	[ALGO_BETWEENNESS] = "betweenness",
+	[ALGO_SCC] = "scc",
+	[ALGO_BCC] = "bcc",
+	[ALGO_TOPO] = "topo",
+};
+
+static int algo_from_name(const char *name)
+{
+	for (uint i = 0; i < sizeof(algo_names) / sizeof(algo_names[0]); i++) {
+		if (strcmp(name, algo_names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static void print_stats(os_threadpool_t *tp)
+{
+	os_threadpool_stats_t workers[NUM_THREADS], total;
+
+	threadpool_get_stats(tp, workers, &total);
+
+	fprintf(stderr, "\n%-8s %10s %10s %10s %12s %12s %12s %9s\n",
+		"worker", "executed", "stolen", "attempts",
+		"busy_us", "idle_us", "blocked_us", "max_depth");
+	for (uint i = 0; i < tp->num_threads; i++)
+		fprintf(stderr, "%-8u %10llu %10llu %10llu %12llu %12llu %12llu %9u\n",
+			i, workers[i].tasks_executed, workers[i].tasks_stolen,
+			workers[i].steal_attempts, workers[i].busy_ns / 1000,
+			workers[i].idle_ns / 1000, workers[i].blocked_ns / 1000,
+			workers[i].max_queue_depth);
+	fprintf(stderr, "%-8s %10llu %10llu %10llu %12llu %12llu %12llu %9u\n",
+		"total", total.tasks_executed, total.tasks_stolen,
+		total.steal_attempts, total.busy_ns / 1000,
+		total.idle_ns / 1000, total.blocked_ns / 1000,
+		total.max_queue_depth);
+}
+
+static int open_output(const char *path)
+{
+	int fd;
+
+	if (strcmp(path, "-") == 0) {
+		// Keep what stdio holds before what the exporter writes
+		fflush(stdout);
+		return STDOUT_FILENO;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	DIE(fd < 0, "open");
+
+	return fd;
+}
 
-static void free_function(void *arg)
+static void close_output(int fd)
 {
-	free(arg);
+	if (fd != STDOUT_FILENO)
+		close(fd);
 }
 
-static void process_node(void *arg)
+static void export_to_path(os_threadpool_t *tp, os_graph_t *graph, int format,
+		const char *path)
 {
-	uint idx = *(uint *) arg;
+	int fd, rc;
 
-	DIE(pthread_mutex_lock(&mutex_graph) != 0, "pthread_mutex_lock");
+	fd = open_output(path);
+	rc = export_graph(tp, graph, format, fd);
+	if (rc < 0) {
+		log_error("Can't export the graph: %s", strerror(-rc));
+		exit(EXIT_FAILURE);
+	}
+	close_output(fd);
+}
 
-	// Check if the node is not visited and process it
-	if (graph->visited[idx] == NOT_VISITED) {
-		os_node_t *node = graph->nodes[idx];
+/* Write one "index value" line per value to path. */
+static void output_values(os_threadpool_t *tp, const long long *values, uint n,
+		const char *path)
+{
+	int fd, rc;
 
-		sum += node->info;
+	fd = open_output(path);
+	rc = export_node_values(tp, values, n, fd);
+	if (rc < 0) {
+		log_error("Can't write %s: %s", path, strerror(-rc));
+		exit(EXIT_FAILURE);
+	}
+	close_output(fd);
+}
 
-		graph->visited[idx] = DONE;
+/* Record the time since start_ns in the latency histogram, if there is one. */
+static void record_latency(os_histogram_t *latency, unsigned long long start_ns)
+{
+	if (latency != NULL)
+		histogram_record(latency, histogram_clock_ns() - start_ns);
+}
 
-		for (uint i = 0; i < node->num_neighbours; i++) {
-			if (graph->visited[node->neighbours[i]] == NOT_VISITED) {
-				// Get the neighbour node and create a new task for it
-				uint *new_arg = malloc(sizeof(uint));
+static void print_latency(os_histogram_t *latency, const char *name)
+{
+	fflush(stdout);
+	fprintf(stderr, "\n");
+	print_histogram_summary(latency, name, stderr);
+	destroy_histogram(latency);
+}
 
-				DIE(!new_arg, "malloc");
+/*
+ * Sum of the info of the nodes reachable from source, run repeat times;
+ * output the BFS tree of the traversal if the options record it.
+ */
+static void run_traverse(os_threadpool_t *tp, os_graph_t *graph, uint source,
+		uint repeat, const os_query_opts_t *opts, const char *tree_path)
+{
+	os_query_result_t result;
+	int fd, rc;
 
-				*new_arg = node->neighbours[i];
+	for (uint i = 0; i < repeat; i++) {
+		if (traverse_parallel(tp, graph, source, opts, &result) < 0)
+			break;
+	}
 
-				os_task_t *new_task = create_task(process_node, new_arg,
-												  free_function);
-				enqueue_task(tp, new_task);
-			}
+	if (result.error < 0) {
+		log_error("Traversal failed: %s", strerror(-result.error));
+		exit(EXIT_FAILURE);
+	}
+
+	if (tree_path != NULL) {
+		fd = open_output(tree_path);
+		rc = export_bfs_tree(tp, opts->parent, opts->level, graph->num_nodes, fd);
+		if (rc < 0) {
+			log_error("Can't write %s: %s", tree_path, strerror(-rc));
+			exit(EXIT_FAILURE);
 		}
+		close_output(fd);
 	}
 
-	DIE(pthread_mutex_unlock(&mutex_graph) != 0, "pthread_mutex_unlock");
+	printf("%lld", result.sum);
+
+	if (result.truncated) {
+		fflush(stdout);
+		fprintf(stderr, "\ntraversal truncated after %u nodes\n", result.num_visited);
+	}
 }
 
-int main(int argc, char *argv[])
+/*
+ * Connected components straight from the file: print the sum of the
+ * component of node 0, as the traversal does, and output the sum of every
+ * component.
+ */
+static void run_cc_stream(os_threadpool_t *tp, const char *path,
+		os_histogram_t *latency, const char *output_path)
 {
-	FILE *input_file;
+	unsigned long long start_ns = histogram_clock_ns();
+	os_components_t *cc;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s input_file\n", argv[0]);
+	cc = stream_components(tp, path);
+	record_latency(latency, start_ns);
+	if (cc == NULL)
 		exit(EXIT_FAILURE);
+
+	if (output_path != NULL)
+		output_values(tp, cc->sums, cc->num_components, output_path);
+
+	printf("%lld", cc->num_nodes > 0 ? cc->sums[cc->component[0]] : 0);
+
+	fflush(stdout);
+	fprintf(stderr, "\n%u components\n", cc->num_components);
+
+	destroy_components(cc);
+}
+
+/*
+ * Distance from source to target, -1 if they are not connected, queried
+ * repeat times; output the nodes of a shortest path.
+ */
+static void run_path(os_threadpool_t *tp, os_graph_t *graph, uint source,
+		uint target, uint repeat, os_histogram_t *latency, const char *output_path)
+{
+	os_path_result_t result;
+	unsigned long long start_ns;
+	long long *nodes;
+
+	for (uint i = 0; i < repeat; i++) {
+		if (i > 0)
+			free(result.path);
+		start_ns = histogram_clock_ns();
+		if (shortest_path(tp, graph, source, target, output_path != NULL,
+				  &result) < 0) {
+			log_error("Path query failed: %s", strerror(-result.error));
+			exit(EXIT_FAILURE);
+		}
+		record_latency(latency, start_ns);
 	}
 
-	input_file = fopen(argv[1], "r");
-	DIE(input_file == NULL, "fopen");
+	if (output_path != NULL && result.connected) {
+		nodes = malloc((result.distance + 1) * sizeof(*nodes));
+		DIE(nodes == NULL, "malloc");
+		for (uint i = 0; i <= result.distance; i++)
+			nodes[i] = result.path[i];
+		output_values(tp, nodes, result.distance + 1, output_path);
+		free(nodes);
+	}
 
-	graph = create_graph_from_file(input_file);
+	printf("%lld", result.connected ? (long long) result.distance : -1LL);
 
-	// Initialize graph synchronization mechanisms
-	pthread_mutex_init(&mutex_graph, NULL);
-	sum = 0;
+	fflush(stdout);
+	fprintf(stderr, "\n%u nodes visited\n", result.num_visited);
+
+	free(result.path);
+}
+
+/*
+ * Effective diameter and average distance estimated by HyperANF; output
+ * the neighbourhood function.
+ */
+static void run_anf(os_threadpool_t *tp, os_graph_t *graph, uint log2m,
+		uint max_steps, os_histogram_t *latency, const char *output_path)
+{
+	unsigned long long start_ns = histogram_clock_ns();
+	os_anf_result_t result;
+	long long *pairs;
+
+	if (hyperanf(tp, graph, log2m, max_steps, &result) < 0) {
+		log_error("HyperANF failed: %s", strerror(-result.error));
+		exit(EXIT_FAILURE);
+	}
+	record_latency(latency, start_ns);
+
+	if (output_path != NULL) {
+		pairs = malloc((result.num_steps + 1) * sizeof(*pairs));
+		DIE(pairs == NULL, "malloc");
+		for (uint t = 0; t <= result.num_steps; t++)
+			pairs[t] = llround(result.neighbourhood[t]);
+		output_values(tp, pairs, result.num_steps + 1, output_path);
+		free(pairs);
+	}
 
-	// Initialize the visited array
-	for (uint i = 0; i < graph->num_nodes; i++)
-		graph->visited[i] = NOT_VISITED;
+	printf("%.2f", result.effective_diameter);
+
+	fflush(stdout);
+	fprintf(stderr, "\naverage distance %.2f, %u steps\n",
+		result.average_distance, result.num_steps);
+
+	free(result.neighbourhood);
+}
+
+/*
+ * Communities found by label propagation: print their number and output
+ * the community of every node.
+ */
+static void run_lpa(os_threadpool_t *tp, os_graph_t *graph, double threshold,
+		uint max_rounds, os_histogram_t *latency, const char *output_path)
+{
+	unsigned long long start_ns = histogram_clock_ns();
+	os_communities_t *c;
+	long long *values;
+
+	c = label_propagation(tp, graph, threshold, max_rounds);
+	record_latency(latency, start_ns);
+	if (c == NULL)
+		exit(EXIT_FAILURE);
+
+	if (output_path != NULL) {
+		values = malloc(((size_t) c->num_nodes + 1) * sizeof(*values));
+		DIE(values == NULL, "malloc");
+		for (uint i = 0; i < c->num_nodes; i++)
+			values[i] = c->community[i];
+		output_values(tp, values, c->num_nodes, output_path);
+		free(values);
+	}
+
+	printf("%u", c->num_communities);
+
+	fflush(stdout);
+	fprintf(stderr, "\n%u rounds\n", c->num_rounds);
+
+	destroy_communities(c);
+}
+
+/*
+ * Betweenness centrality, exact or from sampled sources: print the highest
+ * score and output the score of every node, rounded.
+ */
+static void run_betweenness(os_threadpool_t *tp, os_graph_t *graph,
+		uint num_samples, uint64_t seed, os_histogram_t *latency,
+		const char *output_path)
+{
+	unsigned long long start_ns = histogram_clock_ns();
+	os_betweenness_result_t result;
+	uint best = 0;
+	int fd, rc;
+
+	if (betweenness(tp, graph, num_samples, seed, &result) < 0) {
+		log_error("Betweenness failed: %s", strerror(-result.error));
+		exit(EXIT_FAILURE);
+	}
+	record_latency(latency, start_ns);
+
+	// Scores are fractional, write them as doubles instead of rounding them
+	if (output_path != NULL) {
+		fd = open_output(output_path);
+		rc = export_node_doubles(tp, result.scores, graph->num_nodes, fd);
+		if (rc < 0) {
+			log_error("Can't write %s: %s", output_path, strerror(-rc));
+			exit(EXIT_FAILURE);
+		}
+		close_output(fd);
+	}
+
+	for (uint i = 1; i < graph->num_nodes; i++) {
+		if (result.scores[i] > result.scores[best])
+			best = i;
+	}
+	printf("%.2f", graph->num_nodes > 0 ? result.scores[best] : 0.0);
+
+	fflush(stdout);
+	fprintf(stderr, "\nnode %u, %u %s sources", best, result.num_sources,
+		result.exact ? "exact" : "sampled");
+	if (!result.exact)
+		fprintf(stderr, ", seed %llu", (unsigned long long) seed);
+	fprintf(stderr, "\n");
+
+	free(result.scores);
+}
+
+/*
+ * Strongly connected components: print their number and output the
+ * component of every node.
+ */
+static void run_scc(os_threadpool_t *tp, os_graph_t *graph, os_histogram_t *latency,
+		const char *output_path)
+{
+	unsigned long long start_ns = histogram_clock_ns();
+	os_scc_t *scc;
+	long long *values;
+	uint largest = 0;
+
+	scc = strongly_connected_components(tp, graph);
+	record_latency(latency, start_ns);
+	if (scc == NULL)
+		exit(EXIT_FAILURE);
+
+	if (output_path != NULL) {
+		values = malloc(((size_t) scc->num_nodes + 1) * sizeof(*values));
+		DIE(values == NULL, "malloc");
+		for (uint i = 0; i < scc->num_nodes; i++)
+			values[i] = scc->component[i];
+		output_values(tp, values, scc->num_nodes, output_path);
+		free(values);
+	}
+
+	for (uint i = 0; i < scc->num_components; i++) {
+		if (scc->sizes[i] > largest)
+			largest = scc->sizes[i];
+	}
+
+	printf("%u", scc->num_components);
+
+	fflush(stdout);
+	fprintf(stderr, "\nlargest %u nodes; %u trimmed, %u pivot, %u colored\n",
+		largest, scc->num_trimmed, scc->pivot_size, scc->num_colored);
+
+	destroy_scc(scc);
+}
+
+/*
+ * Biconnected components: print their number and output whether every
+ * node is an articulation point.
+ */
+static void run_bcc(os_threadpool_t *tp, os_graph_t *graph, os_histogram_t *latency,
+		const char *output_path)
+{
+	unsigned long long start_ns = histogram_clock_ns();
+	os_bcc_t *bcc;
+	long long *values;
+
+	bcc = biconnected_components(tp, graph, false);
+	record_latency(latency, start_ns);
+	if (bcc == NULL)
+		exit(EXIT_FAILURE);
+
+	if (output_path != NULL) {
+		values = malloc(((size_t) bcc->num_nodes + 1) * sizeof(*values));
+		DIE(values == NULL, "malloc");
+		for (uint i = 0; i < bcc->num_nodes; i++)
+			values[i] = bcc->articulation[i];
+		output_values(tp, values, bcc->num_nodes, output_path);
+		free(values);
+	}
+
+	printf("%u", bcc->num_components);
+
+	fflush(stdout);
+	fprintf(stderr, "\n%u articulation points, %u bridges\n",
+		bcc->num_articulation_points, bcc->num_bridges);
+
+	destroy_bcc(bcc);
+}
+
+/*
+ * Topological sort of a directed graph: print the length of its critical
+ * path and output the finish of every node, or report a cycle.
+ */
+static void run_topo(os_threadpool_t *tp, os_graph_t *graph, os_histogram_t *latency,
+		const char *output_path)
+{
+	unsigned long long start_ns = histogram_clock_ns();
+	os_topo_t *topo;
+
+	topo = topological_sort(tp, graph);
+	record_latency(latency, start_ns);
+	if (topo == NULL)
+		exit(EXIT_FAILURE);
+
+	if (topo->cyclic) {
+		fprintf(stderr, "The graph has a cycle of %u nodes:", topo->cycle_length);
+		for (uint i = 0; i < topo->cycle_length; i++)
+			fprintf(stderr, " %u", topo->cycle[i]);
+		fprintf(stderr, "\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (output_path != NULL)
+		output_values(tp, topo->finish, topo->num_nodes, output_path);
+
+	printf("%lld", topo->critical_length);
+
+	fflush(stdout);
+	fprintf(stderr, "\n%u levels, critical path of %u nodes", topo->num_levels,
+		topo->critical_path_length);
+	if (topo->critical_path_length > 0)
+		fprintf(stderr, " from %u to %u", topo->critical_path[0],
+			topo->critical_path[topo->critical_path_length - 1]);
+	fprintf(stderr, "\n");
+
+	destroy_topo(topo);
+}
+
+/* Seed of the random choices of a run not given one with --seed. */
+static uint64_t random_seed(void)
+{
+	struct timespec ts;
+	uint64_t seed;
+
+	if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) == sizeof(seed))
+		return seed;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec + getpid();
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] input_file\n"
+		"       %s [options] --attach-shm name\n"
+		"Options:\n"
+		"  --stats              print threadpool statistics\n"
+		"  --repeat n           run the traversal or path query n times\n"
+		"  --latency            print the latency distribution of the\n"
+		"                       queries of the algorithm\n"
+		"  --timeout-ms ms      stop the traversal after ms milliseconds\n"
+		"  --tree path          run the traversal breadth first and write\n"
+		"                       \"node parent level\" lines to path\n"
+		"  --publish-shm name   publish the graph in shared memory\n"
+		"  --export path        write the graph to path (- for stdout)\n"
+		"  --export-format fmt  adjacency (default), edges, binary\n"
+		"                       or compressed\n"
+		"  --no-cache           don't use a binary cache of the input\n"
+		"  --format fmt         auto (default), native, snap or mtx;\n"
+		"                       snap edges from a pipe or - (stdin) are streamed\n"
+		"  --default-value v    value of the nodes of snap and mtx inputs\n"
+		"  --directed           keep the direction of the edges of a text\n"
+		"                       input, from the first node to the second;\n"
+		"                       binary graphs and shared memory segments\n"
+		"                       keep the direction they were written with\n"
+		"  --algo name          traverse (default); cc-stream: sums of\n"
+		"                       the connected components, without loading\n"
+		"                       the graph; path: distance from source\n"
+		"                       to target; anf: effective diameter;\n"
+		"                       lpa: communities by label propagation;\n"
+		"                       betweenness: betweenness centrality;\n"
+		"                       scc: strongly connected components;\n"
+		"                       bcc: biconnected components;\n"
+		"                       topo: critical path of a directed acyclic\n"
+		"                       graph, the info of a node being its cost\n"
+		"  --source n           node the algorithm starts from (default 0)\n"
+		"  --target n           node the path algorithm looks for\n"
+		"  --log2m n            anf registers per node, as a power of 2\n"
+		"  --max-steps n        stop anf or lpa after n steps\n"
+		"  --threshold f        stop lpa when at most this fraction of\n"
+		"                       the nodes change community (default 0.001)\n"
+		"  --samples n          betweenness from n random sources\n"
+		"                       instead of all of them\n"
+		"  --epsilon e          betweenness from enough random sources\n"
+		"                       for a normalized error below e\n"
+		"  --seed n             seed of the betweenness sources, to\n"
+		"                       reproduce a run (default: random)\n"
+		"  --output path        write the per node or per component results\n"
+		"                       of the algorithm to path (- for stdout)\n",
+		prog, prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "stats", no_argument, NULL, 's' },
+		{ "repeat", required_argument, NULL, 'r' },
+		{ "latency", no_argument, NULL, 'l' },
+		{ "timeout-ms", required_argument, NULL, 't' },
+		{ "tree", required_argument, NULL, 'B' },
+		{ "publish-shm", required_argument, NULL, 'p' },
+		{ "attach-shm", required_argument, NULL, 'a' },
+		{ "export", required_argument, NULL, 'e' },
+		{ "export-format", required_argument, NULL, 'f' },
+		{ "no-cache", no_argument, NULL, 'n' },
+		{ "format", required_argument, NULL, 'F' },
+		{ "default-value", required_argument, NULL, 'd' },
+		{ "directed", no_argument, NULL, 'D' },
+		{ "algo", required_argument, NULL, 'A' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "source", required_argument, NULL, 'S' },
+		{ "target", required_argument, NULL, 'T' },
+		{ "log2m", required_argument, NULL, 'm' },
+		{ "max-steps", required_argument, NULL, 'M' },
+		{ "threshold", required_argument, NULL, 'H' },
+		{ "samples", required_argument, NULL, 'k' },
+		{ "epsilon", required_argument, NULL, 'E' },
+		{ "seed", required_argument, NULL, 'R' },
+		{ NULL, 0, NULL, 0 }
+	};
+	os_load_opts_t load_opts = { .default_value = OS_LOAD_DEFAULT_VALUE };
+	os_graph_t *graph;
+	os_threadpool_t *tp;
+	os_query_opts_t opts = { 0 };
+	unsigned int repeat = 1;
+	bool show_stats = false, show_latency = false;
+	const char *publish_name = NULL, *attach_name = NULL;
+	const char *export_path = NULL, *output_path = NULL, *tree_path = NULL;
+	int export_format = OS_EXPORT_ADJACENCY;
+	int algo = ALGO_TRAVERSE;
+	uint source = 0, target = 0;
+	uint log2m = OS_ANF_DEFAULT_LOG2M, max_steps = 0;
+	double threshold = OS_LPA_DEFAULT_THRESHOLD, epsilon = 0;
+	uint num_samples = 0;
+	uint64_t seed = random_seed();
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			show_stats = true;
+			break;
+		case 'r':
+			repeat = strtoul(optarg, NULL, 10);
+			if (repeat == 0)
+				usage(argv[0]);
+			break;
+		case 'l':
+			show_latency = true;
+			break;
+		case 't':
+			opts.timeout_ns = strtoull(optarg, NULL, 10) * 1000000ULL;
+			break;
+		case 'B':
+			tree_path = optarg;
+			break;
+		case 'p':
+			publish_name = optarg;
+			break;
+		case 'a':
+			attach_name = optarg;
+			break;
+		case 'e':
+			export_path = optarg;
+			break;
+		case 'f':
+			export_format = export_format_from_name(optarg);
+			if (export_format < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			load_opts.no_cache = true;
+			break;
+		case 'F':
+			load_opts.format = graph_format_from_name(optarg);
+			if ((int) load_opts.format < 0)
+				usage(argv[0]);
+			break;
+		case 'd':
+			load_opts.default_value = strtol(optarg, NULL, 10);
+			break;
+		case 'D':
+			load_opts.directed = true;
+			break;
+		case 'A':
+			algo = algo_from_name(optarg);
+			if (algo < 0)
+				usage(argv[0]);
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		case 'S':
+			source = strtoul(optarg, NULL, 10);
+			break;
+		case 'T':
+			target = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			log2m = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			max_steps = strtoul(optarg, NULL, 10);
+			break;
+		case 'H':
+			threshold = strtod(optarg, NULL);
+			break;
+		case 'k':
+			num_samples = strtoul(optarg, NULL, 10);
+			break;
+		case 'E':
+			epsilon = strtod(optarg, NULL);
+			break;
+		case 'R':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
 
 	tp = create_threadpool(NUM_THREADS);
+	DIE(tp == NULL, "create_threadpool");
 
-	// Create the initial task argument
-	uint *initial_arg = malloc(sizeof(uint));
+	// Each query of the algorithm is recorded, labelled by its name
+	if (show_latency) {
+		opts.latency = create_histogram();
+		DIE(opts.latency == NULL, "create_histogram");
+	}
+
+	if (algo == ALGO_CC_STREAM) {
+		if (attach_name != NULL || optind != argc - 1)
+			usage(argv[0]);
+
+		run_cc_stream(tp, argv[optind], opts.latency, output_path);
+		if (show_latency)
+			print_latency(opts.latency, algo_names[algo]);
+		wait_for_completion(tp);
+		destroy_threadpool(tp);
+		return 0;
+	}
+
+	if (attach_name != NULL) {
+		if (optind != argc || publish_name != NULL)
+			usage(argv[0]);
+
+		graph = graph_attach_shm(attach_name);
+		if (graph == NULL)
+			exit(EXIT_FAILURE);
+	} else {
+		if (optind != argc - 1)
+			usage(argv[0]);
+
+		load_opts.tp = tp;
+		// The loader and the publisher log why they failed
+		graph = load_graph(argv[optind], &load_opts);
+		if (graph == NULL)
+			exit(EXIT_FAILURE);
+
+		if (publish_name != NULL && graph_publish_shm(graph, publish_name) < 0)
+			exit(EXIT_FAILURE);
+	}
 
-	DIE(initial_arg == NULL, "malloc");
+	if (export_path != NULL)
+		export_to_path(tp, graph, export_format, export_path);
 
-	// Start processing the graph from the node 0
-	*initial_arg = 0;
-	os_task_t *initial_task = create_task(process_node, initial_arg,
-										  free_function);
-	enqueue_task(tp, initial_task);
+	if (tree_path != NULL) {
+		opts.parent = malloc(((size_t) graph->num_nodes + 1) * sizeof(*opts.parent));
+		opts.level = malloc(((size_t) graph->num_nodes + 1) * sizeof(*opts.level));
+		DIE(opts.parent == NULL || opts.level == NULL, "malloc");
+	}
+
+	// Repeated traversals reuse one visited set instead of allocating it
+	if (repeat > 1) {
+		opts.visited = create_visited(graph->num_nodes);
+		DIE(opts.visited == NULL, "create_visited");
+	}
+
+	switch (algo) {
+	case ALGO_PATH:
+		run_path(tp, graph, source, target, repeat, opts.latency, output_path);
+		break;
+	case ALGO_ANF:
+		run_anf(tp, graph, log2m, max_steps, opts.latency, output_path);
+		break;
+	case ALGO_TOPO:
+		run_topo(tp, graph, opts.latency, output_path);
+		break;
+	case ALGO_BCC:
+		run_bcc(tp, graph, opts.latency, output_path);
+		break;
+	case ALGO_SCC:
+		run_scc(tp, graph, opts.latency, output_path);
+		break;
+	case ALGO_BETWEENNESS:
+		if (num_samples == 0 && epsilon > 0)
+			num_samples = betweenness_sample_size(graph->num_nodes, epsilon);
+		run_betweenness(tp, graph, num_samples, seed, opts.latency, output_path);
+		break;
+	case ALGO_LPA:
+		run_lpa(tp, graph, threshold,
+			max_steps != 0 ? max_steps : OS_LPA_DEFAULT_MAX_ROUNDS,
+			opts.latency, output_path);
+		break;
+	default:
+		run_traverse(tp, graph, source, repeat, &opts, tree_path);
+	}
+
+	if (show_latency)
+		print_latency(opts.latency, algo_names[algo]);
 
 	wait_for_completion(tp);
-	destroy_threadpool(tp);
 
-	pthread_mutex_destroy(&mutex_graph);
+	if (show_stats) {
+		fflush(stdout);
+		print_stats(tp);
+	}
 
-	printf("%d", sum);
+	destroy_threadpool(tp);
+	destroy_graph(graph);
+	free(opts.parent);
+	free(opts.level);
+	if (opts.visited != NULL)
+		destroy_visited(opts.visited);
 
 	return 0;
 }
@@ -2,44 +2,138 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include "os_export.h"
 #include "os_graph.h"
+#include "os_graph_load.h"
+#include "os_histogram.h"
+#include "os_traverse.h"
 #include "log/log.h"
 #include "utils.h"
 
-static int sum;
-static os_graph_t *graph;
-
-static void process_node(unsigned int idx)
+static void usage(const char *prog)
 {
-	os_node_t *node;
-
-	node = graph->nodes[idx];
-	sum += node->info;
-	graph->visited[idx] = DONE;
-
-	for (unsigned int i = 0; i < node->num_neighbours; i++)
-		if (graph->visited[node->neighbours[i]] == NOT_VISITED)
-			process_node(node->neighbours[i]);
+	fprintf(stderr, "Usage: %s [--repeat n] [--latency] [--no-cache]\n"
+		"       [--format auto|native|snap|mtx] [--default-value v]\n"
+		"       [--tree path] input_file|-\n",
+		prog);
+	exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[])
 {
-	FILE *input_file;
+	static const struct option options[] = {
+		{ "repeat", required_argument, NULL, 'r' },
+		{ "latency", no_argument, NULL, 'l' },
+		{ "no-cache", no_argument, NULL, 'n' },
+		{ "format", required_argument, NULL, 'F' },
+		{ "default-value", required_argument, NULL, 'd' },
+		{ "tree", required_argument, NULL, 'B' },
+		{ NULL, 0, NULL, 0 }
+	};
+	os_load_opts_t load_opts = { .default_value = OS_LOAD_DEFAULT_VALUE };
+	os_graph_t *graph;
+	os_query_opts_t opts = { 0 };
+	os_query_result_t result;
+	unsigned int repeat = 1;
+	bool show_latency = false;
+	const char *tree_path = NULL;
+	int opt, fd, rc;
+
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = strtoul(optarg, NULL, 10);
+			if (repeat == 0)
+				usage(argv[0]);
+			break;
+		case 'l':
+			show_latency = true;
+			break;
+		case 'n':
+			load_opts.no_cache = true;
+			break;
+		case 'F':
+			load_opts.format = graph_format_from_name(optarg);
+			if ((int) load_opts.format < 0)
+				usage(argv[0]);
+			break;
+		case 'd':
+			load_opts.default_value = strtol(optarg, NULL, 10);
+			break;
+		case 'B':
+			tree_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s input_file\n", argv[0]);
+	// The loader logs why it failed
+	graph = load_graph(argv[optind], &load_opts);
+	if (graph == NULL)
 		exit(EXIT_FAILURE);
+
+	if (show_latency) {
+		opts.latency = create_histogram();
+		DIE(opts.latency == NULL, "create_histogram");
 	}
 
-	input_file = fopen(argv[1], "r");
-	DIE(input_file == NULL, "fopen");
+	// Record the BFS tree, "node parent level" lines written to tree_path
+	if (tree_path != NULL) {
+		opts.parent = malloc(((size_t) graph->num_nodes + 1) * sizeof(*opts.parent));
+		opts.level = malloc(((size_t) graph->num_nodes + 1) * sizeof(*opts.level));
+		DIE(opts.parent == NULL || opts.level == NULL, "malloc");
+	}
 
-	graph = create_graph_from_file(input_file);
+	// Repeated traversals reuse one visited set instead of allocating it
+	if (repeat > 1) {
+		opts.visited = create_visited(graph->num_nodes);
+		DIE(opts.visited == NULL, "create_visited");
+	}
+
+	for (unsigned int i = 0; i < repeat; i++) {
+		if (traverse_serial(graph, 0, &opts, &result) < 0) {
+			log_error("Traversal failed: %s", strerror(-result.error));
+			exit(EXIT_FAILURE);
+		}
+	}
 
-	process_node(0);
+	if (tree_path != NULL) {
+		fd = strcmp(tree_path, "-") == 0 ? STDOUT_FILENO :
+			open(tree_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		DIE(fd < 0, "open");
+		rc = export_bfs_tree(NULL, opts.parent, opts.level, graph->num_nodes, fd);
+		if (rc < 0) {
+			log_error("Can't write %s: %s", tree_path, strerror(-rc));
+			exit(EXIT_FAILURE);
+		}
+		if (fd != STDOUT_FILENO)
+			close(fd);
+	}
+
+	printf("%lld", result.sum);
+
+	if (show_latency) {
+		fflush(stdout);
+		fprintf(stderr, "\n");
+		print_histogram_summary(opts.latency, "traversal", stderr);
+		destroy_histogram(opts.latency);
+	}
 
-	printf("%d", sum);
+	destroy_graph(graph);
+	free(opts.parent);
+	free(opts.level);
+	if (opts.visited != NULL)
+		destroy_visited(opts.visited);
 
 	return 0;
 }